@@ -0,0 +1,94 @@
+#include "arena.h"
+
+#include <new>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+        thread_local Arena* current_arena = nullptr;
+
+        constexpr size_t ALIGNMENT = alignof(std::max_align_t);
+
+        // Every Executable is preceded by the arena it was placed in, nullptr for the heap
+        constexpr size_t HEADER_SIZE = ALIGNMENT;
+
+        size_t AlignUp(size_t size) {
+            return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        }
+    }  // namespace
+
+    void* Arena::Allocate(size_t size) {
+        size = AlignUp(size);
+        if (size > static_cast<size_t>(this->end_ - this->next_)) {
+            if (size > BLOCK_SIZE / 4) {
+                // A large node gets a block of its own, the current one stays open
+                auto& block = this->blocks_.emplace_back(new std::byte[size]);
+                this->used_ += size;
+                return block.get();
+            }
+            this->next_ = this->blocks_.emplace_back(new std::byte[BLOCK_SIZE]).get();
+            this->end_ = this->next_ + BLOCK_SIZE;
+        }
+        void* result = this->next_;
+        this->next_ += size;
+        this->used_ += size;
+        return result;
+    }
+
+    size_t Arena::GetBlockCount() const {
+        return this->blocks_.size();
+    }
+
+    size_t Arena::GetUsedBytes() const {
+        return this->used_;
+    }
+
+    Arena::Scope::Scope(Arena& arena) : previous_(current_arena) {
+        current_arena = &arena;
+    }
+
+    Arena::Scope::~Scope() {
+        current_arena = this->previous_;
+    }
+
+    Arena* Arena::Current() {
+        return current_arena;
+    }
+
+    void* Executable::operator new(size_t size) {
+        Arena* arena = current_arena;
+        void* memory = arena != nullptr ? arena->Allocate(size + HEADER_SIZE) : ::operator new(size + HEADER_SIZE);
+        *static_cast<Arena**>(memory) = arena;
+        return static_cast<std::byte*>(memory) + HEADER_SIZE;
+    }
+
+    void Executable::operator delete(void* ptr) {
+        if (ptr == nullptr) {
+            return;
+        }
+        void* memory = static_cast<std::byte*>(ptr) - HEADER_SIZE;
+        // Arena memory is released together with its arena
+        if (*static_cast<Arena**>(memory) == nullptr) {
+            ::operator delete(memory);
+        }
+    }
+
+    ArenaProgram::ArenaProgram(std::shared_ptr<Arena> arena, std::unique_ptr<Executable> root)
+        : arena_(std::move(arena)), root_(std::move(root)) {
+    }
+
+    ObjectHolder ArenaProgram::Execute(Closure& closure, Context& context) {
+        return this->root_->Execute(closure, context);
+    }
+
+    void ArenaProgram::Compile(bytecode::Compiler& compiler) {
+        this->root_->Compile(compiler);
+    }
+
+    const Arena& ArenaProgram::GetArena() const {
+        return *this->arena_;
+    }
+
+}  // namespace runtime
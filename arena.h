@@ -0,0 +1,68 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace runtime {
+
+    // Bump allocator for the nodes of a parsed program. Nothing is freed until the arena itself
+    // is destroyed, and then all of its blocks go at once. An arena made by make_shared is kept
+    // alive by the classes parsed into it, see Class
+    class Arena : public std::enable_shared_from_this<Arena> {
+    public:
+        Arena() = default;
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        // The returned memory is aligned as max_align_t
+        void* Allocate(size_t size);
+
+        [[nodiscard]] size_t GetBlockCount() const;
+
+        [[nodiscard]] size_t GetUsedBytes() const;
+
+        // While a scope is alive, Executables created on its thread are placed in the arena
+        class Scope {
+        public:
+            explicit Scope(Arena& arena);
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            ~Scope();
+        private:
+            Arena* previous_;
+        };
+
+        // nullptr outside of any Scope
+        [[nodiscard]] static Arena* Current();
+    private:
+        static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+        std::vector<std::unique_ptr<std::byte[]>> blocks_;
+        std::byte* next_ = nullptr;
+        std::byte* end_ = nullptr;
+        size_t used_ = 0;
+    };
+
+    // A parsed program together with the arena holding its nodes
+    class ArenaProgram : public Executable {
+    public:
+        ArenaProgram(std::shared_ptr<Arena> arena, std::unique_ptr<Executable> root);
+
+        ObjectHolder Execute(Closure& closure, Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        [[nodiscard]] const Arena& GetArena() const;
+    private:
+        std::shared_ptr<Arena> arena_;
+        // Declared after the arena, so it is destroyed first
+        std::unique_ptr<Executable> root_;
+    };
+
+}  // namespace runtime
@@ -0,0 +1,644 @@
+#include "cache.h"
+#include "flat.h"
+#include "gc.h"
+#include "lexer.h"
+#include "log_duration.h"
+#include "parse.h"
+#include "runtime.h"
+#include "statement.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <variant>
+
+using namespace std;
+
+namespace benchmark {
+
+    using runtime::ObjectHolder;
+
+    namespace {
+        // The former return path: the value travels up to the method body inside an exception
+        struct ThrownReturn : public std::runtime_error {
+            explicit ThrownReturn(ObjectHolder value) : std::runtime_error(std::string()), value(std::move(value)) {}
+
+            ObjectHolder value;
+        };
+
+        class ThrowingReturn : public ast::Statement {
+        public:
+            explicit ThrowingReturn(std::unique_ptr<ast::Statement> statement) : st_(std::move(statement)) {}
+
+            ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override {
+                throw ThrownReturn(this->st_->Execute(closure, context));
+            }
+        private:
+            std::unique_ptr<ast::Statement> st_;
+        };
+
+        class ThrowingMethodBody : public ast::Statement {
+        public:
+            explicit ThrowingMethodBody(std::unique_ptr<ast::Statement>&& body) : body_(std::move(body)) {}
+
+            ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override {
+                try {
+                    this->body_->Execute(closure, context);
+                } catch (ThrownReturn& e) {
+                    return e.value;
+                }
+                return ObjectHolder::None();
+            }
+        private:
+            std::unique_ptr<ast::Statement> body_;
+        };
+
+        // class Countdown:
+        //   def down(n):
+        //     if n > 0:
+        //       return self.down(n - 1) + 1
+        //     return 0
+        template <typename ReturnNode, typename BodyNode>
+        runtime::Class MakeCountdown() {
+            vector<unique_ptr<ast::Statement>> args;
+            args.push_back(make_unique<ast::Sub>(make_unique<ast::VariableValue>("n"s), make_unique<ast::NumericConst>(1)));
+            auto call = make_unique<ast::MethodCall>(make_unique<ast::VariableValue>("self"s), "down"s, std::move(args));
+
+            auto if_body = make_unique<ast::Compound>(
+                make_unique<ReturnNode>(make_unique<ast::Add>(std::move(call), make_unique<ast::NumericConst>(1))));
+            auto body = make_unique<ast::Compound>(
+                make_unique<ast::IfElse>(
+                    make_unique<ast::Comparison>(runtime::Greater, make_unique<ast::VariableValue>("n"s), make_unique<ast::NumericConst>(0)),
+                    std::move(if_body), nullptr),
+                make_unique<ReturnNode>(make_unique<ast::NumericConst>(0)));
+
+            vector<runtime::Method> methods;
+            methods.push_back({ "down"s, { "n"s }, make_unique<BodyNode>(std::move(body)) });
+            return runtime::Class("Countdown"s, std::move(methods), nullptr);
+        }
+
+        template <typename ReturnNode, typename BodyNode>
+        void RunCountdown(std::string_view name, int depth, int repeat, ostream& out) {
+            const auto cls = MakeCountdown<ReturnNode, BodyNode>();
+            runtime::ClassInstance instance(cls);
+            runtime::DummyContext context;
+            const runtime::Symbol down = "down";
+
+            int64_t total = 0;
+            {
+                LOG_DURATION_STREAM(name, out);
+                for (int i = 0; i < repeat; i++) {
+                    total += instance.Call(down, { ObjectHolder::Own(runtime::Number(depth)) }, context).TryAs<runtime::Number>()->GetValue();
+                }
+            }
+            out << "  "sv << total << " returns"sv << endl;
+        }
+    }  // namespace
+
+    void RunRecursionBenchmark(ostream& out) {
+        const int depth = 500;
+        const int repeat = 400;
+        out << "Deep recursion, depth "sv << depth << " x "sv << repeat << endl;
+        RunCountdown<ThrowingReturn, ThrowingMethodBody>("  return by exception"sv, depth, repeat, out);
+        RunCountdown<ast::Return, ast::MethodBody>("  return by completion signal"sv, depth, repeat, out);
+    }
+
+    // (x * 3 + 7) / 2 - x < x, every operator produces a fresh Number or Bool
+    void RunArithmeticBenchmark(ostream& out) {
+        const int repeat = 2'000'000;
+        auto var = [] {
+            return make_unique<ast::VariableValue>("x"s);
+        };
+        ast::Comparison expr(runtime::Less,
+            make_unique<ast::Sub>(
+                make_unique<ast::Div>(
+                    make_unique<ast::Add>(make_unique<ast::Mult>(var(), make_unique<ast::NumericConst>(3)), make_unique<ast::NumericConst>(7)),
+                    make_unique<ast::NumericConst>(2)),
+                var()),
+            var());
+
+        runtime::Closure closure;
+        runtime::DummyContext context;
+        const runtime::Symbol x = "x";
+        int true_count = 0;
+        out << "Arithmetics, "sv << repeat << " expressions"sv << endl;
+        {
+            LOG_DURATION_STREAM("  tree-walker"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                closure[x] = ObjectHolder::Own(runtime::Number(i));
+                true_count += runtime::IsTrue(expr.Execute(closure, context));
+            }
+        }
+        out << "  "sv << true_count << " true"sv << endl;
+    }
+
+    // Literals of every kind: x == 3 or s < 'abd' and not True
+    void RunLiteralBenchmark(ostream& out) {
+        const int repeat = 2'000'000;
+        ast::Or expr(
+            make_unique<ast::Comparison>(runtime::Equal, make_unique<ast::VariableValue>("x"s), make_unique<ast::NumericConst>(3)),
+            make_unique<ast::And>(
+                make_unique<ast::Comparison>(runtime::Less, make_unique<ast::VariableValue>("s"s), make_unique<ast::StringConst>("abd"s)),
+                make_unique<ast::Not>(make_unique<ast::BoolConst>(true))));
+
+        runtime::Closure closure;
+        runtime::DummyContext context;
+        const runtime::Symbol x = "x";
+        closure["s"s] = ObjectHolder::Own(runtime::String("abc"s));
+        int true_count = 0;
+        out << "Literals, "sv << repeat << " expressions"sv << endl;
+        {
+            LOG_DURATION_STREAM("  tree-walker"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                closure[x] = ObjectHolder::Own(runtime::Number(i % 5));
+                true_count += runtime::IsTrue(expr.Execute(closure, context));
+            }
+        }
+        out << "  "sv << true_count << " true"sv << endl;
+    }
+
+    // Conditions over string variables and fields: a < b and not a == self.name or b > self.name
+    void RunConditionBenchmark(ostream& out) {
+        const int repeat = 2'000'000;
+        auto var = [](std::string name) {
+            return make_unique<ast::VariableValue>(runtime::Symbol(name));
+        };
+        auto field = [] {
+            return make_unique<ast::VariableValue>(vector<runtime::Symbol>{ "self"s, "name"s });
+        };
+        ast::IfElse cond(
+            make_unique<ast::Or>(
+                make_unique<ast::And>(
+                    make_unique<ast::Comparison>(runtime::Less, var("a"s), var("b"s)),
+                    make_unique<ast::Not>(make_unique<ast::Comparison>(runtime::Equal, var("a"s), field()))),
+                make_unique<ast::Comparison>(runtime::Greater, var("b"s), field())),
+            make_unique<ast::NumericConst>(1), make_unique<ast::NumericConst>(0));
+
+        runtime::Class cls("Named"s, {}, nullptr);
+        runtime::Closure closure;
+        closure["self"s] = ObjectHolder::Own(runtime::ClassInstance(cls));
+        closure["self"s].TryAs<runtime::ClassInstance>()->SetField("name"s, ObjectHolder::Own(runtime::String("middle"s)));
+        const ObjectHolder words[] = {
+            ObjectHolder::Own(runtime::String("apple"s)), ObjectHolder::Own(runtime::String("middle"s)),
+            ObjectHolder::Own(runtime::String("zebra"s)),
+        };
+        runtime::DummyContext context;
+        const runtime::Symbol a = "a";
+        const runtime::Symbol b = "b";
+        int hits = 0;
+        out << "Conditions, "sv << repeat << " evaluations"sv << endl;
+        {
+            LOG_DURATION_STREAM("  tree-walker"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                closure[a] = words[i % 3];
+                closure[b] = words[(i / 3) % 3];
+                hits += cond.Execute(closure, context).TryAs<runtime::Number>()->GetValue();
+            }
+        }
+        out << "  "sv << hits << " true"sv << endl;
+    }
+
+    // Balanced tree of arithmetic over x and small constants
+    unique_ptr<ast::Statement> MakeExpression(int depth, int& seed) {
+        ++seed;
+        if (depth == 0) {
+            if (seed % 3 == 0) {
+                return make_unique<ast::NumericConst>(seed % 7 + 1);
+            }
+            return make_unique<ast::VariableValue>("x"s);
+        }
+        auto lhs = MakeExpression(depth - 1, seed);
+        auto rhs = MakeExpression(depth - 1, seed);
+        switch (seed % 3) {
+        case 0:
+            return make_unique<ast::Add>(std::move(lhs), std::move(rhs));
+        case 1:
+            return make_unique<ast::Sub>(std::move(lhs), std::move(rhs));
+        default:
+            return make_unique<ast::Mult>(std::move(lhs), std::move(rhs));
+        }
+    }
+
+    // Comparisons of such trees joined by and, or and not
+    unique_ptr<ast::Statement> MakeCondition(int depth, int& seed) {
+        if (depth == 0) {
+            auto lhs = MakeExpression(4, seed);
+            auto rhs = MakeExpression(4, seed);
+            return make_unique<ast::Comparison>(seed % 2 ? runtime::Less : runtime::GreaterOrEqual, std::move(lhs), std::move(rhs));
+        }
+        auto lhs = MakeCondition(depth - 1, seed);
+        auto rhs = MakeCondition(depth - 1, seed);
+        if (depth % 2) {
+            return make_unique<ast::And>(std::move(lhs), make_unique<ast::Not>(std::move(rhs)));
+        }
+        return make_unique<ast::Or>(std::move(lhs), std::move(rhs));
+    }
+
+    void RunFlatExpressionBenchmark(ostream& out) {
+        const int repeat = 20'000;
+        int seed = 0;
+        auto tree = MakeCondition(4, seed);
+        seed = 0;
+        ast::FlatExpression flat(MakeCondition(4, seed));
+
+        runtime::Closure closure;
+        runtime::DummyContext context;
+        const runtime::Symbol x = "x";
+        out << "Flat expressions, "sv << flat.GetNodes().size() << " nodes, "sv << repeat << " evaluations"sv << endl;
+        int tree_true = 0;
+        {
+            LOG_DURATION_STREAM("  pointer tree"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                closure[x] = ObjectHolder::Own(runtime::Number(i % 100));
+                tree_true += runtime::IsTrue(tree->Execute(closure, context));
+            }
+        }
+        int flat_true = 0;
+        {
+            LOG_DURATION_STREAM("  flat"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                closure[x] = ObjectHolder::Own(runtime::Number(i % 100));
+                flat_true += runtime::IsTrue(flat.Execute(closure, context));
+            }
+        }
+        out << "  "sv << tree_true << " and "sv << flat_true << " true"sv << endl;
+    }
+
+    namespace {
+        // Fills argument lists the way MethodCall does, returns the number of copies made
+        template <typename Holder>
+        int64_t CopyHolders(const Holder& holder, int repeat, std::string_view name, ostream& out) {
+            constexpr int ARGS = 4;
+            vector<Holder> args;
+            args.reserve(ARGS);
+            int64_t copies = 0;
+            LogDuration timer(name, out);
+            for (int i = 0; i < repeat; i++) {
+                for (int arg = 0; arg < ARGS; arg++) {
+                    args.push_back(holder);
+                }
+                copies += static_cast<int64_t>(args.size());
+                args.clear();
+            }
+            return copies;
+        }
+    }  // namespace
+
+    // Copies of a holder of a string: the former holder over std::shared_ptr against the
+    // intrusive count. libstdc++ makes shared_ptr counting atomic once the process has started
+    // a thread (as the parallel lexer does), so both are run before and after one is started
+    void RunHolderCopyBenchmark(ostream& out) {
+        using SharedHolder = std::variant<std::monostate, std::shared_ptr<runtime::Object>, runtime::Number, runtime::Bool>;
+
+        const int repeat = 5'000'000;
+        out << "Holder copies, "sv << repeat * 4 << " per run"sv << endl;
+        const SharedHolder shared = std::make_shared<runtime::String>("text"s);
+        const auto holder = ObjectHolder::Own(runtime::String("text"s));
+        const auto atomic = ObjectHolder::Own(runtime::String("text"s));
+        atomic->ShareAcrossThreads();
+
+        int64_t copies = 0;
+        copies += CopyHolders(shared, repeat, "  shared_ptr, single thread"sv, out);
+        copies += CopyHolders(holder, repeat, "  intrusive, single thread"sv, out);
+        std::thread([] {}).join();
+        copies += CopyHolders(shared, repeat, "  shared_ptr, after a thread"sv, out);
+        copies += CopyHolders(holder, repeat, "  intrusive, after a thread"sv, out);
+        copies += CopyHolders(atomic, repeat, "  intrusive, shared across threads"sv, out);
+        out << "  "sv << copies << " copies"sv << endl;
+    }
+
+    // Type checks of the comparison helpers on strings and of IsTrue on every kind of object
+    void RunTypeCheckBenchmark(ostream& out) {
+        const int repeat = 2'000'000;
+        runtime::Class cls("Empty"s, {}, nullptr);
+        const vector<ObjectHolder> objects = {
+            ObjectHolder::Own(runtime::String("abc"s)), ObjectHolder::Own(runtime::String("abd"s)),
+            ObjectHolder::Own(runtime::Number(1)), ObjectHolder::Own(runtime::Bool(true)),
+            ObjectHolder::Own(runtime::ClassInstance(cls)), ObjectHolder::None(),
+        };
+        runtime::DummyContext context;
+
+        out << "Type checks, "sv << repeat << " operations"sv << endl;
+        int hits = 0;
+        {
+            LOG_DURATION_STREAM("  Equal"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                hits += runtime::Equal(objects[i & 1], objects[(i >> 1) & 1], context);
+            }
+        }
+        {
+            LOG_DURATION_STREAM("  Less"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                hits += runtime::Less(objects[i & 1], objects[(i >> 1) & 1], context);
+            }
+        }
+        {
+            LOG_DURATION_STREAM("  IsTrue"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                hits += runtime::IsTrue(objects[i % objects.size()]);
+            }
+        }
+        out << "  "sv << hits << " hits"sv << endl;
+    }
+
+    // Small instances with three fields each, filled and read through field caches as self.x does
+    void RunFieldsBenchmark(ostream& out) {
+        const int count = 1'000'000;
+        runtime::Class cls("Point"s, {}, nullptr);
+        runtime::FieldCache x("x"s), y("y"s), z("z"s);
+        vector<runtime::ClassInstance> instances;
+        instances.reserve(count);
+
+        out << "Fields, "sv << count << " instances"sv << endl;
+        {
+            LOG_DURATION_STREAM("  create"sv, out);
+            for (int i = 0; i < count; i++) {
+                auto& instance = instances.emplace_back(cls);
+                x.Assign(instance, ObjectHolder::Own(runtime::Number(i)));
+                y.Assign(instance, ObjectHolder::Own(runtime::Number(1)));
+                z.Assign(instance, ObjectHolder::None());
+            }
+        }
+        int64_t total = 0;
+        {
+            LOG_DURATION_STREAM("  read"sv, out);
+            for (auto& instance : instances) {
+                total += x.Find(instance)->TryAs<runtime::Number>()->GetValue() + y.Find(instance)->TryAs<runtime::Number>()->GetValue();
+            }
+        }
+        out << "  "sv << total << " sum"sv << endl;
+    }
+
+    // Dunder lookups the runtime makes outside of call sites, on the leaf of an 8 level hierarchy
+    void RunMethodLookupBenchmark(ostream& out) {
+        const int repeat = 2'000'000;
+        vector<unique_ptr<runtime::Class>> chain;
+        for (int level = 0; level < 8; level++) {
+            vector<runtime::Method> methods;
+            for (const auto* name : { "__init__", "__add__", "__lt__", "value" }) {
+                methods.push_back({ name + "_"s + std::to_string(level), {}, nullptr });
+            }
+            if (level == 0) {
+                methods.push_back({ "__str__"s, {}, nullptr });
+            }
+            chain.push_back(make_unique<runtime::Class>("L"s + std::to_string(level), std::move(methods), chain.empty() ? nullptr : chain.back().get()));
+        }
+        runtime::ClassInstance instance(*chain.back());
+
+        out << "Method lookup, "sv << repeat << " x 2 lookups"sv << endl;
+        const runtime::Symbol str = "__str__", eq = "__eq__";
+        int found = 0;
+        {
+            LOG_DURATION_STREAM("  HasMethod"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                found += instance.HasMethod(str, 0);
+                found += instance.HasMethod(eq, 1);
+            }
+        }
+        out << "  "sv << found << " found"sv << endl;
+    }
+
+    // A generated config-like program of a few megabytes
+    string MakeLexerInput(int classes) {
+        string result;
+        for (int i = 0; i < classes; i++) {
+            const string name = "Config"s + std::to_string(i);
+            result += "class "s + name + ":\n"s;
+            result += "  def __init__(name, value):\n"s;
+            result += "    self.name = name  # field comment\n"s;
+            result += "    self.value = value * 2 + 17\n\n"s;
+            result += "  def describe():\n"s;
+            result += "    if self.value >= 100 and not self.name == 'skip':\n"s;
+            result += "      return \"big \" + self.name\n"s;
+            result += "    return 'small \\'"s + name + "\\''\n"s;
+            result += name + "_item = "s + name + "('item "s + std::to_string(i) + "', "s + std::to_string(i) + ")\n"s;
+        }
+        return result;
+    }
+
+    void RunLexerBenchmark(ostream& out) {
+        const string text = MakeLexerInput(20'000);
+        out << "Lexer, "sv << text.size() / 1024 << " KB"sv << endl;
+        size_t tokens = 0;
+        {
+            LOG_DURATION_STREAM("  stream"sv, out);
+            istringstream input(text);
+            parse::Lexer lexer(input);
+            while (!lexer.NextToken().Is<parse::token_type::Eof>()) {
+                ++tokens;
+            }
+        }
+        {
+            LOG_DURATION_STREAM("  borrowed buffer"sv, out);
+            parse::Lexer lexer(parse::Source::Borrow(text));
+            while (!lexer.NextToken().Is<parse::token_type::Eof>()) {
+                ++tokens;
+            }
+        }
+        {
+            LOG_DURATION_STREAM("  parallel, "s + std::to_string(std::thread::hardware_concurrency()) + " threads"s, out);
+            parse::Lexer lexer(parse::Source::Borrow(text), parse::LexerMode::Parallel);
+            while (!lexer.NextToken().Is<parse::token_type::Eof>()) {
+                ++tokens;
+            }
+        }
+        out << "  "sv << tokens << " tokens"sv << endl;
+    }
+
+    // Identifiers and keywords only, so nearly all the time goes to LoadId
+    void RunIdentifierBenchmark(ostream& out) {
+        string text;
+        const char* words[] = { "value", "class", "if", "return", "counter", "None", "not", "print", "and", "self", "True", "else", "item_name", "def" };
+        for (int line = 0; line < 200'000; line++) {
+            for (int word = 0; word < 10; word++) {
+                text += words[(line + word * 3) % std::size(words)];
+                text += ' ';
+            }
+            text += '\n';
+        }
+
+        out << "Identifier-dense lexing, "sv << text.size() / 1024 << " KB"sv << endl;
+        size_t ids = 0;
+        {
+            LOG_DURATION_STREAM("  lexer"sv, out);
+            parse::Lexer lexer(parse::Source::Borrow(text));
+            for (auto token = lexer.CurrentToken(); !token.Is<parse::token_type::Eof>(); token = lexer.NextToken()) {
+                ids += token.Is<parse::token_type::Id>();
+            }
+        }
+        out << "  "sv << ids << " ids"sv << endl;
+    }
+
+    // Deeply indented lines with long literals and space runs, where the scanners skip whole blocks
+    void RunLongLiteralBenchmark(ostream& out) {
+        string text;
+        for (int line = 0; line < 100'000; line++) {
+            text += string(2 * (line % 24), ' ');
+            text += "description_of_the_generated_item_"s + std::to_string(line);
+            text += " =                    'a generated literal that is long enough to span several blocks' + "s;
+            text += "\"another one with an escaped \\\" quote inside\"  # trailing comment\n"s;
+        }
+
+        out << "Long literal lexing, "sv << text.size() / 1024 << " KB"sv << endl;
+        size_t strings = 0;
+        {
+            LOG_DURATION_STREAM("  lexer"sv, out);
+            parse::Lexer lexer(parse::Source::Borrow(text));
+            for (auto token = lexer.CurrentToken(); !token.Is<parse::token_type::Eof>(); token = lexer.NextToken()) {
+                strings += token.Is<parse::token_type::String>();
+            }
+        }
+        out << "  "sv << strings << " strings"sv << endl;
+    }
+
+    // Many small scripts parsed and thrown away, as a job runner does
+    void RunParseTeardownBenchmark(ostream& out) {
+        const int repeat = 5'000;
+        const string text = MakeLexerInput(10);
+        out << "Parse and drop, "sv << repeat << " scripts of "sv << text.size() << " bytes"sv << endl;
+        size_t bytes = 0;
+        {
+            LOG_DURATION_STREAM("  parse"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                parse::Lexer lexer(parse::Source::Borrow(text));
+                auto program = ParseProgram(lexer);
+                bytes += static_cast<const runtime::ArenaProgram&>(*program).GetArena().GetUsedBytes();
+            }
+        }
+        out << "  "sv << bytes / repeat << " arena bytes per script"sv << endl;
+    }
+
+    // A one-line edit of the generated program: full reparse against the incremental one
+    void RunIncrementalBenchmark(ostream& out) {
+        const int repeat = 20;
+        const string text = MakeLexerInput(5'000);
+        parse::IncrementalProgram program(text);
+        const size_t lines = program.GetLineCount();
+        out << "Incremental reparse, "sv << lines << " lines, "sv << repeat << " edits"sv << endl;
+        {
+            LOG_DURATION_STREAM("  full parse"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                parse::Lexer lexer(parse::Source::Borrow(text));
+                ParseProgram(lexer);
+            }
+        }
+        size_t reparsed = 0;
+        {
+            LOG_DURATION_STREAM("  incremental"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                const size_t line = lines - 1 - i * 10;
+                program.Edit(line, 1, "Config"s + std::to_string(4'999 - i) + "_item = "s + std::to_string(i) + "\n"s);
+                reparsed += program.GetReparsedCount();
+            }
+        }
+        out << "  "sv << reparsed << " units reparsed"sv << endl;
+    }
+
+    // Startup of a compiled program: parse and compile against loading the saved one
+    void RunCacheBenchmark(ostream& out) {
+        const int repeat = 20;
+        const string text = MakeLexerInput(2'000);
+        const uint64_t hash = bytecode::HashSource(text);
+        string data;
+        {
+            parse::Lexer lexer(parse::Source::Borrow(text));
+            auto tree = ParseProgram(lexer);
+            ostringstream os;
+            bytecode::Save(*bytecode::Compile(*tree), hash, os);
+            data = os.str();
+        }
+        out << "Compiled program cache, "sv << text.size() / 1024 << " KB of source, "sv << data.size() / 1024 << " KB cached"sv << endl;
+        size_t chunks = 0;
+        {
+            LOG_DURATION_STREAM("  parse and compile"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                parse::Lexer lexer(parse::Source::Borrow(text));
+                auto tree = ParseProgram(lexer);
+                chunks += bytecode::Compile(*tree)->chunks.size();
+            }
+        }
+        {
+            LOG_DURATION_STREAM("  hash and load"sv, out);
+            for (int i = 0; i < repeat; i++) {
+                chunks += bytecode::Load(data, bytecode::HashSource(text))->chunks.size();
+            }
+        }
+        out << "  "sv << chunks << " chunks"sv << endl;
+    }
+
+    // Cyclic pairs a.peer = b, b.peer = a dropped right away, freed only by the cycle collector
+    void RunCycleCollectorBenchmark(ostream& out) {
+        const int pairs = 2'000'000;
+        runtime::Class cls("Node"s, {}, nullptr);
+        const runtime::Symbol peer = "peer";
+        runtime::CycleCollector collector;
+        out << "Cycle collector, "sv << pairs << " cyclic pairs"sv << endl;
+        size_t peak = 0;
+        {
+            LOG_DURATION_STREAM("  allocate and collect"sv, out);
+            runtime::CycleCollector::Scope scope(collector);
+            for (int i = 0; i < pairs; i++) {
+                auto a = ObjectHolder::Own(runtime::ClassInstance(cls));
+                auto b = ObjectHolder::Own(runtime::ClassInstance(cls));
+                a.TryAs<runtime::ClassInstance>()->SetField(peer, b);
+                b.TryAs<runtime::ClassInstance>()->SetField(peer, a);
+                peak = std::max(peak, collector.GetTrackedCount());
+            }
+        }
+        out << "  peak "sv << peak << " tracked instances"sv << endl;
+        collector.DumpStats(out);
+    }
+
+    // Churn of short-lived cycles next to a large graph that lives through the whole run
+    void RunGenerationalBenchmark(ostream& out) {
+        const int kept = 200'000;
+        const int pairs = 2'000'000;
+        runtime::Class cls("Node"s, {}, nullptr);
+        const runtime::Symbol peer = "peer";
+        const runtime::Symbol next = "next";
+        out << "Cycle collector, "sv << kept << " long-lived and "sv << pairs << " cyclic pairs"sv << endl;
+        for (auto mode : { runtime::CollectorMode::Full, runtime::CollectorMode::Generational }) {
+            runtime::CycleCollector collector(mode);
+            runtime::CycleCollector::Scope scope(collector);
+            ObjectHolder list;
+            for (int i = 0; i < kept; i++) {
+                auto node = ObjectHolder::Own(runtime::ClassInstance(cls));
+                node.TryAs<runtime::ClassInstance>()->SetField(next, std::move(list));
+                list = std::move(node);
+            }
+            {
+                LOG_DURATION_STREAM(mode == runtime::CollectorMode::Full ? "  full"sv : "  generational"sv, out);
+                for (int i = 0; i < pairs; i++) {
+                    auto a = ObjectHolder::Own(runtime::ClassInstance(cls));
+                    auto b = ObjectHolder::Own(runtime::ClassInstance(cls));
+                    a.TryAs<runtime::ClassInstance>()->SetField(peer, b);
+                    b.TryAs<runtime::ClassInstance>()->SetField(peer, a);
+                }
+            }
+            collector.DumpStats(out);
+        }
+    }
+
+    void RunBenchmarks(ostream& out) {
+        RunRecursionBenchmark(out);
+        RunArithmeticBenchmark(out);
+        RunLiteralBenchmark(out);
+        RunConditionBenchmark(out);
+        RunFlatExpressionBenchmark(out);
+        RunHolderCopyBenchmark(out);
+        RunTypeCheckBenchmark(out);
+        RunFieldsBenchmark(out);
+        RunMethodLookupBenchmark(out);
+        RunCycleCollectorBenchmark(out);
+        RunGenerationalBenchmark(out);
+        RunLexerBenchmark(out);
+        RunIdentifierBenchmark(out);
+        RunLongLiteralBenchmark(out);
+        RunParseTeardownBenchmark(out);
+        RunIncrementalBenchmark(out);
+        RunCacheBenchmark(out);
+    }
+
+}  // namespace benchmark
@@ -0,0 +1,99 @@
+#include "bytecode.h"
+
+#include <limits>
+
+using namespace std;
+
+namespace runtime {
+
+    void Executable::Compile(bytecode::Compiler& compiler) {
+        compiler.EmitFallback(*this);
+    }
+
+}  // namespace runtime
+
+namespace bytecode {
+
+    std::unique_ptr<Program> Compiler::Compile(runtime::Executable& program) {
+        this->program_ = std::make_unique<Program>();
+        this->name_ids_.clear();
+        this->class_ids_.clear();
+        this->program_->chunks.emplace_back();
+        this->CompileChunk(0, program);
+        return std::move(this->program_);
+    }
+
+    size_t Compiler::Emit(OpCode op, uint32_t arg, size_t count) {
+        if (count > numeric_limits<uint16_t>::max()) {
+            throw CompileError("Too many arguments");
+        }
+        auto& code = this->CurrentChunk().code;
+        code.push_back({ op, static_cast<uint16_t>(count), arg });
+        return code.size() - 1;
+    }
+
+    void Compiler::PatchJump(size_t jump) {
+        auto& code = this->CurrentChunk().code;
+        code[jump].arg = static_cast<uint32_t>(code.size());
+    }
+
+    uint32_t Compiler::AddConstant(Constant value) {
+        this->program_->constants.push_back(std::move(value));
+        return static_cast<uint32_t>(this->program_->constants.size() - 1);
+    }
+
+    uint32_t Compiler::AddName(runtime::Symbol name) {
+        auto [it, inserted] = this->name_ids_.insert({ name, static_cast<uint32_t>(this->program_->names.size()) });
+        if (inserted) {
+            this->program_->names.push_back(name);
+        }
+        return it->second;
+    }
+
+    uint32_t Compiler::AddClass(const runtime::Class& cls) {
+        if (auto it = this->class_ids_.find(&cls); it != this->class_ids_.end()) {
+            return it->second;
+        }
+        ClassInfo info;
+        info.name = cls.GetName();
+        if (cls.GetParent() != nullptr) {
+            info.parent = this->AddClass(*cls.GetParent());
+        }
+
+        // The class is registered before its methods are compiled, so they may refer to it
+        const auto id = static_cast<uint32_t>(this->program_->classes.size());
+        this->class_ids_[&cls] = id;
+        for (const auto& method : cls.GetMethods()) {
+            info.methods.push_back({ method.name, method.formal_params, static_cast<uint32_t>(this->program_->chunks.size()), method.frame_size });
+            this->program_->chunks.emplace_back();
+        }
+        this->program_->classes.push_back(info);
+
+        for (size_t ptr = 0; ptr < info.methods.size(); ptr++) {
+            this->CompileChunk(info.methods[ptr].chunk, *cls.GetMethods()[ptr].body);
+        }
+        return id;
+    }
+
+    void Compiler::EmitFallback(runtime::Executable& node) {
+        this->program_->fallbacks.push_back(&node);
+        this->Emit(OpCode::Exec, static_cast<uint32_t>(this->program_->fallbacks.size() - 1));
+    }
+
+    void Compiler::CompileChunk(uint32_t chunk, runtime::Executable& body) {
+        const auto saved_chunk = this->current_chunk_;
+        this->current_chunk_ = chunk;
+        body.Compile(*this);
+        this->Emit(OpCode::Return);
+        this->current_chunk_ = saved_chunk;
+    }
+
+    Chunk& Compiler::CurrentChunk() {
+        return this->program_->chunks[this->current_chunk_];
+    }
+
+    std::unique_ptr<Program> Compile(runtime::Executable& program) {
+        return Compiler{}.Compile(program);
+    }
+
+}  // namespace bytecode
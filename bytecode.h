@@ -0,0 +1,121 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace bytecode {
+
+    // Every instruction leaves exactly one value on the stack, unless stated otherwise
+    enum class OpCode : uint8_t {
+        LoadConst,      // arg: constant index
+        LoadNone,
+        LoadVar,        // arg: name index
+        LoadLocal,      // arg: frame slot
+        LoadField,      // arg: name index, pops the object
+        StoreVar,       // arg: name index, keeps the stored value on the stack
+        StoreLocal,     // arg: frame slot, keeps the stored value on the stack
+        StoreField,     // arg: name index, pops value and object, pushes the value back
+        Pop,            // pushes nothing
+        Print,          // count: number of arguments, pushes None
+        Stringify,
+        Add,
+        Sub,
+        Mult,
+        Div,
+        And,            // both operands are already evaluated, as in ast::And
+        Or,
+        Not,
+        Equal,
+        NotEqual,
+        Less,
+        Greater,
+        LessOrEqual,
+        GreaterOrEqual,
+        Jump,           // arg: target, pushes nothing
+        JumpIfFalse,    // arg: target, pops the condition
+        CallMethod,     // arg: name index, count: number of arguments
+        NewInstance,    // arg: class index, count: number of arguments passed to __init__
+        DefineClass,    // arg: class index
+        Return,         // pops the result and leaves the chunk
+        Exec,           // arg: fallback node index, runs the node with the tree-walker
+    };
+
+    struct Instruction {
+        OpCode op;
+        uint16_t count = 0;
+        uint32_t arg = 0;
+    };
+
+    using Constant = std::variant<int, std::string, bool>;
+
+    struct Chunk {
+        std::vector<Instruction> code;
+    };
+
+    struct MethodInfo {
+        runtime::Symbol name;
+        std::vector<runtime::Symbol> formal_params;
+        uint32_t chunk;
+        size_t frame_size;
+    };
+
+    struct ClassInfo {
+        std::string name;
+        // Index of the parent class in Program::classes, parents always go first
+        std::optional<uint32_t> parent;
+        std::vector<MethodInfo> methods;
+    };
+
+    // Chunk 0 is the program itself, the rest are method bodies
+    struct Program {
+        std::vector<Chunk> chunks;
+        std::vector<Constant> constants;
+        std::vector<runtime::Symbol> names;
+        std::vector<ClassInfo> classes;
+        // Nodes without a lowering, they are not owned and must outlive the program
+        std::vector<runtime::Executable*> fallbacks;
+    };
+
+    class CompileError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    class Compiler {
+    public:
+        [[nodiscard]] std::unique_ptr<Program> Compile(runtime::Executable& program);
+
+        size_t Emit(OpCode op, uint32_t arg = 0, size_t count = 0);
+
+        // Points the jump at the next emitted instruction
+        void PatchJump(size_t jump);
+
+        [[nodiscard]] uint32_t AddConstant(Constant value);
+
+        [[nodiscard]] uint32_t AddName(runtime::Symbol name);
+
+        [[nodiscard]] uint32_t AddClass(const runtime::Class& cls);
+
+        void EmitFallback(runtime::Executable& node);
+    private:
+        void CompileChunk(uint32_t chunk, runtime::Executable& body);
+
+        Chunk& CurrentChunk();
+
+        std::unique_ptr<Program> program_;
+        uint32_t current_chunk_ = 0;
+        std::unordered_map<runtime::Symbol, uint32_t> name_ids_;
+        std::unordered_map<const runtime::Class*, uint32_t> class_ids_;
+    };
+
+    std::unique_ptr<Program> Compile(runtime::Executable& program);
+
+}  // namespace bytecode
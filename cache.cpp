@@ -0,0 +1,391 @@
+#include "cache.h"
+#include "parse.h"
+
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+
+using namespace std;
+
+namespace bytecode {
+
+    namespace {
+        constexpr char MAGIC[4] = { 'M', 'Y', 'C', '\0' };
+        constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 4 + 8 + 8;
+
+        constexpr uint64_t FNV_OFFSET = 14695981039346656037ULL;
+        constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+        enum class ConstantTag : uint8_t {
+            Int,
+            String,
+            Bool,
+        };
+
+        uint64_t Fnv1a(std::string_view data, uint64_t hash = FNV_OFFSET) {
+            for (char c : data) {
+                hash = (hash ^ static_cast<uint8_t>(c)) * FNV_PRIME;
+            }
+            return hash;
+        }
+
+        // Fixed-width little-endian integers and length-prefixed strings
+        class Writer {
+        public:
+            void U8(uint8_t value) {
+                this->data_.push_back(static_cast<char>(value));
+            }
+
+            void U16(uint16_t value) {
+                this->Unsigned(value, 2);
+            }
+
+            void U32(uint32_t value) {
+                this->Unsigned(value, 4);
+            }
+
+            void U64(uint64_t value) {
+                this->Unsigned(value, 8);
+            }
+
+            void String(std::string_view value) {
+                this->U32(static_cast<uint32_t>(value.size()));
+                this->data_.append(value);
+            }
+
+            [[nodiscard]] const std::string& GetData() const {
+                return this->data_;
+            }
+        private:
+            void Unsigned(uint64_t value, size_t size) {
+                for (size_t ptr = 0; ptr < size; ptr++) {
+                    this->data_.push_back(static_cast<char>((value >> (8 * ptr)) & 0xFF));
+                }
+            }
+
+            std::string data_;
+        };
+
+        struct BadData {};
+
+        // Throws BadData when the data ends early
+        class Reader {
+        public:
+            explicit Reader(std::string_view data) : data_(data) {}
+
+            uint8_t U8() {
+                return static_cast<uint8_t>(this->Unsigned(1));
+            }
+
+            uint16_t U16() {
+                return static_cast<uint16_t>(this->Unsigned(2));
+            }
+
+            uint32_t U32() {
+                return static_cast<uint32_t>(this->Unsigned(4));
+            }
+
+            uint64_t U64() {
+                return this->Unsigned(8);
+            }
+
+            std::string_view String() {
+                return this->Take(this->U32());
+            }
+
+            // Count of the items that follow, each taking at least min_size bytes
+            size_t Count(size_t min_size) {
+                const size_t count = this->U32();
+                if (count > this->data_.size() / min_size) {
+                    throw BadData{};
+                }
+                return count;
+            }
+
+            std::string_view Take(size_t size) {
+                if (size > this->data_.size()) {
+                    throw BadData{};
+                }
+                auto result = this->data_.substr(0, size);
+                this->data_.remove_prefix(size);
+                return result;
+            }
+
+            [[nodiscard]] bool AtEnd() const {
+                return this->data_.empty();
+            }
+        private:
+            uint64_t Unsigned(size_t size) {
+                auto bytes = this->Take(size);
+                uint64_t result = 0;
+                for (size_t ptr = 0; ptr < size; ptr++) {
+                    result |= static_cast<uint64_t>(static_cast<uint8_t>(bytes[ptr])) << (8 * ptr);
+                }
+                return result;
+            }
+
+            std::string_view data_;
+        };
+
+        void Expect(bool condition) {
+            if (!condition) {
+                throw BadData{};
+            }
+        }
+
+        void WriteProgram(const Program& program, Writer& out) {
+            out.U32(static_cast<uint32_t>(program.names.size()));
+            for (const auto& name : program.names) {
+                out.String(name.GetName());
+            }
+
+            out.U32(static_cast<uint32_t>(program.constants.size()));
+            for (const auto& constant : program.constants) {
+                if (const auto* num = std::get_if<int>(&constant)) {
+                    out.U8(static_cast<uint8_t>(ConstantTag::Int));
+                    out.U32(static_cast<uint32_t>(*num));
+                } else if (const auto* str = std::get_if<std::string>(&constant)) {
+                    out.U8(static_cast<uint8_t>(ConstantTag::String));
+                    out.String(*str);
+                } else {
+                    out.U8(static_cast<uint8_t>(ConstantTag::Bool));
+                    out.U8(std::get<bool>(constant));
+                }
+            }
+
+            out.U32(static_cast<uint32_t>(program.classes.size()));
+            for (const auto& info : program.classes) {
+                out.String(info.name);
+                out.U8(info.parent.has_value());
+                out.U32(info.parent.value_or(0));
+                out.U32(static_cast<uint32_t>(info.methods.size()));
+                for (const auto& method : info.methods) {
+                    out.String(method.name.GetName());
+                    out.U32(static_cast<uint32_t>(method.formal_params.size()));
+                    for (const auto& param : method.formal_params) {
+                        out.String(param.GetName());
+                    }
+                    out.U32(method.chunk);
+                    out.U64(method.frame_size);
+                }
+            }
+
+            out.U32(static_cast<uint32_t>(program.chunks.size()));
+            for (const auto& chunk : program.chunks) {
+                out.U32(static_cast<uint32_t>(chunk.code.size()));
+                for (const auto& ins : chunk.code) {
+                    out.U8(static_cast<uint8_t>(ins.op));
+                    out.U16(ins.count);
+                    out.U32(ins.arg);
+                }
+            }
+        }
+
+        // Every index an instruction refers to must exist, so the VM can trust the program
+        void CheckChunk(const Program& program, const Chunk& chunk, size_t frame_size) {
+            Expect(!chunk.code.empty() && chunk.code.back().op == OpCode::Return);
+            for (const auto& ins : chunk.code) {
+                switch (ins.op) {
+                case OpCode::LoadConst:
+                    Expect(ins.arg < program.constants.size());
+                    break;
+                case OpCode::LoadVar:
+                case OpCode::StoreVar:
+                case OpCode::LoadField:
+                case OpCode::StoreField:
+                case OpCode::CallMethod:
+                    Expect(ins.arg < program.names.size());
+                    break;
+                case OpCode::LoadLocal:
+                case OpCode::StoreLocal:
+                    Expect(ins.arg < frame_size);
+                    break;
+                case OpCode::Jump:
+                case OpCode::JumpIfFalse:
+                    Expect(ins.arg < chunk.code.size());
+                    break;
+                case OpCode::NewInstance:
+                case OpCode::DefineClass:
+                    Expect(ins.arg < program.classes.size());
+                    break;
+                case OpCode::Exec:
+                    Expect(false);
+                    break;
+                default:
+                    Expect(ins.op <= OpCode::Exec);
+                    break;
+                }
+            }
+        }
+
+        std::unique_ptr<Program> ReadProgram(Reader& in) {
+            auto program = std::make_unique<Program>();
+
+            program->names.reserve(in.Count(4));
+            for (size_t count = program->names.capacity(); count > 0; count--) {
+                program->names.emplace_back(in.String());
+            }
+
+            const size_t constant_count = in.Count(2);
+            program->constants.reserve(constant_count);
+            for (size_t ptr = 0; ptr < constant_count; ptr++) {
+                switch (static_cast<ConstantTag>(in.U8())) {
+                case ConstantTag::Int:
+                    program->constants.emplace_back(static_cast<int>(in.U32()));
+                    break;
+                case ConstantTag::String:
+                    program->constants.emplace_back(std::string(in.String()));
+                    break;
+                case ConstantTag::Bool:
+                    program->constants.emplace_back(in.U8() != 0);
+                    break;
+                default:
+                    throw BadData{};
+                }
+            }
+
+            const size_t class_count = in.Count(13);
+            program->classes.resize(class_count);
+            for (size_t id = 0; id < class_count; id++) {
+                auto& info = program->classes[id];
+                info.name = in.String();
+                const bool has_parent = in.U8() != 0;
+                const uint32_t parent = in.U32();
+                if (has_parent) {
+                    Expect(parent < id);
+                    info.parent = parent;
+                }
+                const size_t method_count = in.Count(20);
+                for (size_t ptr = 0; ptr < method_count; ptr++) {
+                    MethodInfo method;
+                    method.name = in.String();
+                    const size_t param_count = in.Count(4);
+                    for (size_t param = 0; param < param_count; param++) {
+                        method.formal_params.emplace_back(in.String());
+                    }
+                    method.chunk = in.U32();
+                    method.frame_size = in.U64();
+                    // A frame holds the parameters and self at least
+                    Expect(method.chunk > 0 && (method.frame_size == 0 || method.frame_size > param_count));
+                    info.methods.push_back(std::move(method));
+                }
+            }
+
+            const size_t chunk_count = in.Count(4);
+            program->chunks.resize(chunk_count);
+            for (auto& chunk : program->chunks) {
+                const size_t size = in.Count(7);
+                chunk.code.reserve(size);
+                for (size_t ptr = 0; ptr < size; ptr++) {
+                    Instruction ins;
+                    ins.op = static_cast<OpCode>(in.U8());
+                    ins.count = in.U16();
+                    ins.arg = in.U32();
+                    chunk.code.push_back(ins);
+                }
+            }
+            Expect(in.AtEnd());
+
+            // Frame sizes of the chunks, the program itself has no locals
+            std::vector<std::optional<size_t>> frames(program->chunks.size());
+            Expect(!frames.empty());
+            frames[0] = 0;
+            for (const auto& info : program->classes) {
+                for (const auto& method : info.methods) {
+                    Expect(method.chunk < frames.size() && !frames[method.chunk]);
+                    frames[method.chunk] = method.frame_size;
+                }
+            }
+            for (size_t ptr = 0; ptr < frames.size(); ptr++) {
+                Expect(frames[ptr].has_value());
+                CheckChunk(*program, program->chunks[ptr], *frames[ptr]);
+            }
+            return program;
+        }
+    }  // namespace
+
+    uint64_t HashSource(std::string_view text) {
+        return Fnv1a(text);
+    }
+
+    bool CanSave(const Program& program) {
+        return program.fallbacks.empty();
+    }
+
+    // Layout: magic, version, source hash, hash of the body, body
+    void Save(const Program& program, uint64_t source_hash, std::ostream& output) {
+        if (!CanSave(program)) {
+            throw std::invalid_argument("Program with fallbacks can not be saved");
+        }
+        Writer body;
+        WriteProgram(program, body);
+
+        Writer header;
+        for (char c : MAGIC) {
+            header.U8(static_cast<uint8_t>(c));
+        }
+        header.U32(CACHE_VERSION);
+        header.U64(source_hash);
+        header.U64(Fnv1a(body.GetData()));
+        output << header.GetData() << body.GetData();
+    }
+
+    std::unique_ptr<Program> Load(std::string_view data, uint64_t source_hash) {
+        try {
+            Reader in(data);
+            Expect(in.Take(sizeof(MAGIC)) == std::string_view(MAGIC, sizeof(MAGIC)));
+            Expect(in.U32() == CACHE_VERSION);
+            Expect(in.U64() == source_hash);
+            const uint64_t body_hash = in.U64();
+            const auto body = in.Take(data.size() - HEADER_SIZE);
+            Expect(Fnv1a(body) == body_hash);
+            Reader body_in(body);
+            return ReadProgram(body_in);
+        } catch (const BadData&) {
+            return nullptr;
+        }
+    }
+
+    std::string GetCachePath(const std::string& source_path) {
+        return std::filesystem::path(source_path).replace_extension(".myc").string();
+    }
+
+    CachedProgram LoadOrCompile(const std::string& source_path, parse::LexerMode mode) {
+        const auto source = parse::Source::Map(source_path);
+        const uint64_t source_hash = HashSource(source.Text());
+        const auto cache_path = GetCachePath(source_path);
+
+        CachedProgram result;
+        std::error_code error;
+        if (std::filesystem::is_regular_file(cache_path, error)) {
+            result.program = Load(parse::Source::Map(cache_path).Text(), source_hash);
+            if (result.program) {
+                result.from_cache = true;
+                return result;
+            }
+        }
+
+        parse::Lexer lexer(source, mode);
+        result.tree = ParseProgram(lexer);
+        result.program = Compile(*result.tree);
+        if (CanSave(*result.program)) {
+            // Written aside and renamed, so a reader never sees half of a file
+            const auto temp_path = cache_path + ".tmp";
+            bool written = false;
+            {
+                std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+                Save(*result.program, source_hash, output);
+                output.flush();
+                written = static_cast<bool>(output);
+            }
+            if (written) {
+                std::filesystem::rename(temp_path, cache_path, error);
+            }
+            if (!written || error) {
+                std::filesystem::remove(temp_path, error);
+            }
+        }
+        return result;
+    }
+
+}  // namespace bytecode
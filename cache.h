@@ -0,0 +1,42 @@
+#pragma once
+
+#include "bytecode.h"
+#include "lexer.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace bytecode {
+
+    // Binary form of a compiled program (".myc"), stamped with the hash of the source it was
+    // compiled from. The format is versioned, a file of another version is ignored
+    constexpr uint32_t CACHE_VERSION = 1;
+
+    [[nodiscard]] uint64_t HashSource(std::string_view text);
+
+    // Fallbacks are nodes of the syntax tree, so a program that has them can not be saved
+    [[nodiscard]] bool CanSave(const Program& program);
+
+    void Save(const Program& program, uint64_t source_hash, std::ostream& output);
+
+    // nullptr when the data is not a valid program of this version compiled from that source
+    [[nodiscard]] std::unique_ptr<Program> Load(std::string_view data, uint64_t source_hash);
+
+    // The cache lives next to the source: script.my -> script.myc
+    [[nodiscard]] std::string GetCachePath(const std::string& source_path);
+
+    struct CachedProgram {
+        // Parsed tree, kept for the fallbacks of the program. Empty when loaded from the cache
+        std::unique_ptr<runtime::Executable> tree;
+        std::unique_ptr<Program> program;
+        bool from_cache = false;
+    };
+
+    // Loads the program of a source file from its cache when the cache is fresh. Otherwise parses
+    // and compiles the source and rewrites the cache; failing to write it is not an error
+    [[nodiscard]] CachedProgram LoadOrCompile(const std::string& source_path, parse::LexerMode mode = parse::LexerMode::Eager);
+
+}  // namespace bytecode
@@ -0,0 +1,252 @@
+#include "flat.h"
+
+#include <limits>
+#include <new>
+
+using namespace std;
+
+namespace runtime {
+
+    uint32_t Executable::Flatten(ast::FlatBuilder& builder) {
+        return builder.AddLeaf(*this);
+    }
+
+}  // namespace runtime
+
+namespace ast {
+
+    using runtime::ObjectHolder;
+
+    // Raw storage for the value of a node. The node constructs it and the node using it destroys it
+    union FlatExpression::Slot {
+        Slot() {}
+        ~Slot() {}
+
+        ObjectHolder value;
+    };
+
+    namespace {
+        constexpr size_t MIN_OPERATIONS = 2;
+
+        size_t OperandCount(FlatOp op) {
+            switch (op) {
+            case FlatOp::Const:
+            case FlatOp::Variable:
+            case FlatOp::Local:
+            case FlatOp::Leaf:
+                return 0;
+            case FlatOp::Not:
+                return 1;
+            default:
+                return 2;
+            }
+        }
+    }  // namespace
+
+    FlatExpression::FlatExpression(std::unique_ptr<Statement> tree) : tree_(std::move(tree)) {
+        FlatBuilder counter;
+        this->tree_->Flatten(counter);
+        this->nodes_.reserve(counter.GetNodeCount());
+
+        FlatBuilder builder(*this);
+        this->tree_->Flatten(builder);
+        this->slots_ = std::make_unique<Slot[]>(this->nodes_.size());
+    }
+
+    FlatExpression::~FlatExpression() = default;
+
+    std::unique_ptr<Statement> FlatExpression::Flatten(std::unique_ptr<Statement> tree) {
+        // With a single operator the tree-walker is as fast
+        FlatBuilder counter;
+        tree->Flatten(counter);
+        if (counter.GetOperationCount() < MIN_OPERATIONS) {
+            return tree;
+        }
+        return std::make_unique<FlatExpression>(std::move(tree));
+    }
+
+    ObjectHolder FlatExpression::Execute(runtime::Closure& closure, runtime::Context& context) {
+        // A leaf may run a method that evaluates this expression again, the nested run gets slots of its own
+        if (this->running_) {
+            auto slots = std::make_unique<Slot[]>(this->nodes_.size());
+            return this->Evaluate(slots.get(), closure, context);
+        }
+        this->running_ = true;
+        try {
+            auto result = this->Evaluate(this->slots_.get(), closure, context);
+            this->running_ = false;
+            return result;
+        } catch (...) {
+            this->running_ = false;
+            throw;
+        }
+    }
+
+    ObjectHolder FlatExpression::Evaluate(Slot* slots, runtime::Closure& closure, runtime::Context& context) const {
+        size_t index = 0;
+        try {
+            for (; index < this->nodes_.size(); index++) {
+                const FlatNode& node = this->nodes_[index];
+                void* target = &slots[index].value;
+                switch (node.op) {
+                case FlatOp::Const:
+                    new (target) ObjectHolder(this->constants_[node.arg]);
+                    break;
+                case FlatOp::Variable: {
+                    auto it = closure.find(this->names_[node.arg]);
+                    if (it == closure.end()) {
+                        throw std::runtime_error("Not in list");
+                    }
+                    new (target) ObjectHolder(it->second);
+                    break;
+                }
+                case FlatOp::Local: {
+                    const auto& local = context.GetLocal(node.arg);
+                    if (!local) {
+                        throw std::runtime_error("Not in list");
+                    }
+                    new (target) ObjectHolder(*local);
+                    break;
+                }
+                case FlatOp::Leaf:
+                    new (target) ObjectHolder(this->leaves_[node.arg]->Execute(closure, context));
+                    break;
+                case FlatOp::Not: {
+                    auto& arg = slots[node.lhs].value;
+                    new (target) ObjectHolder(ObjectHolder::Own(runtime::Bool(!runtime::IsTrue(arg))));
+                    arg.~ObjectHolder();
+                    break;
+                }
+                default: {
+                    auto& lhs = slots[node.lhs].value;
+                    auto& rhs = slots[node.rhs].value;
+                    switch (node.op) {
+                    case FlatOp::Add:
+                        new (target) ObjectHolder(runtime::Add(lhs, rhs, context));
+                        break;
+                    case FlatOp::Sub:
+                        new (target) ObjectHolder(runtime::Sub(lhs, rhs, context));
+                        break;
+                    case FlatOp::Mult:
+                        new (target) ObjectHolder(runtime::Mult(lhs, rhs, context));
+                        break;
+                    case FlatOp::Div:
+                        new (target) ObjectHolder(runtime::Div(lhs, rhs, context));
+                        break;
+                    case FlatOp::And:
+                        new (target) ObjectHolder(ObjectHolder::Own(runtime::Bool(runtime::IsTrue(lhs) && runtime::IsTrue(rhs))));
+                        break;
+                    case FlatOp::Or:
+                        new (target) ObjectHolder(ObjectHolder::Own(runtime::Bool(runtime::IsTrue(lhs) || runtime::IsTrue(rhs))));
+                        break;
+                    default:
+                        new (target) ObjectHolder(ObjectHolder::Own(runtime::Bool((*this->comparators_[node.arg])(lhs, rhs, context))));
+                        break;
+                    }
+                    lhs.~ObjectHolder();
+                    rhs.~ObjectHolder();
+                    break;
+                }
+                }
+            }
+        } catch (...) {
+            // Values made by the finished nodes and not used yet
+            std::vector<bool> used(index, false);
+            for (size_t ptr = 0; ptr < index; ptr++) {
+                const size_t operands = OperandCount(this->nodes_[ptr].op);
+                if (operands > 0) {
+                    used[this->nodes_[ptr].lhs] = true;
+                }
+                if (operands > 1) {
+                    used[this->nodes_[ptr].rhs] = true;
+                }
+            }
+            for (size_t ptr = 0; ptr < index; ptr++) {
+                if (!used[ptr]) {
+                    slots[ptr].value.~ObjectHolder();
+                }
+            }
+            throw;
+        }
+        auto& root = slots[this->nodes_.size() - 1].value;
+        ObjectHolder result = std::move(root);
+        root.~ObjectHolder();
+        return result;
+    }
+
+    void FlatExpression::Compile(bytecode::Compiler& compiler) {
+        this->tree_->Compile(compiler);
+    }
+
+    const std::vector<FlatNode>& FlatExpression::GetNodes() const {
+        return this->nodes_;
+    }
+
+    uint32_t FlatBuilder::AddConstant(ObjectHolder value) {
+        uint32_t arg = 0;
+        if (this->expression_ != nullptr) {
+            auto& constants = this->expression_->constants_;
+            constants.push_back(std::move(value));
+            arg = static_cast<uint32_t>(constants.size() - 1);
+        }
+        return this->AddNode({ FlatOp::Const, 0, 0, arg });
+    }
+
+    uint32_t FlatBuilder::AddVariable(runtime::Symbol name) {
+        uint32_t arg = 0;
+        if (this->expression_ != nullptr) {
+            auto& names = this->expression_->names_;
+            names.push_back(name);
+            arg = static_cast<uint32_t>(names.size() - 1);
+        }
+        return this->AddNode({ FlatOp::Variable, 0, 0, arg });
+    }
+
+    uint32_t FlatBuilder::AddLocal(size_t slot) {
+        return this->AddNode({ FlatOp::Local, 0, 0, static_cast<uint32_t>(slot) });
+    }
+
+    uint32_t FlatBuilder::AddLeaf(Statement& leaf) {
+        uint32_t arg = 0;
+        if (this->expression_ != nullptr) {
+            auto& leaves = this->expression_->leaves_;
+            leaves.push_back(&leaf);
+            arg = static_cast<uint32_t>(leaves.size() - 1);
+        }
+        return this->AddNode({ FlatOp::Leaf, 0, 0, arg });
+    }
+
+    uint32_t FlatBuilder::AddOperation(FlatOp op, uint32_t lhs, uint32_t rhs) {
+        return this->AddNode({ op, lhs, rhs, 0 });
+    }
+
+    uint32_t FlatBuilder::AddComparison(const Comparison::Comparator& cmp, uint32_t lhs, uint32_t rhs) {
+        uint32_t arg = 0;
+        if (this->expression_ != nullptr) {
+            auto& comparators = this->expression_->comparators_;
+            comparators.push_back(&cmp);
+            arg = static_cast<uint32_t>(comparators.size() - 1);
+        }
+        return this->AddNode({ FlatOp::Compare, lhs, rhs, arg });
+    }
+
+    size_t FlatBuilder::GetNodeCount() const {
+        return this->nodes_;
+    }
+
+    size_t FlatBuilder::GetOperationCount() const {
+        return this->operations_;
+    }
+
+    uint32_t FlatBuilder::AddNode(FlatNode node) {
+        if (this->nodes_ >= numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("Expression is too large");
+        }
+        this->operations_ += OperandCount(node.op) > 0;
+        if (this->expression_ != nullptr) {
+            this->expression_->nodes_.push_back(node);
+        }
+        return static_cast<uint32_t>(this->nodes_++);
+    }
+
+}  // namespace ast
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "statement.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ast {
+
+    enum class FlatOp : uint8_t {
+        Const,
+        // Single names read from the Closure or from a local slot
+        Variable,
+        Local,
+        // A subtree without a flat form, run with Execute
+        Leaf,
+        Add,
+        Sub,
+        Mult,
+        Div,
+        And,
+        Or,
+        Not,
+        Compare,
+    };
+
+    struct FlatNode {
+        FlatOp op;
+        // Indices of the operands, which always come before the node
+        uint32_t lhs = 0;
+        uint32_t rhs = 0;
+        // Index of the constant, name, slot, leaf or comparator of the node
+        uint32_t arg = 0;
+    };
+
+    // Expression stored as one vector of nodes in post-order. Operands are referred to by index,
+    // so evaluation walks the vector front to back instead of chasing child pointers
+    class FlatExpression : public Statement {
+    public:
+        // The tree is kept: its leaves are run from it and it is what gets compiled to bytecode
+        explicit FlatExpression(std::unique_ptr<Statement> tree);
+
+        ~FlatExpression() override;
+
+        // Wraps the tree when it has a few operators to flatten, returns it as is otherwise
+        static std::unique_ptr<Statement> Flatten(std::unique_ptr<Statement> tree);
+
+        runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        [[nodiscard]] const std::vector<FlatNode>& GetNodes() const;
+    private:
+        friend class FlatBuilder;
+
+        union Slot;
+
+        runtime::ObjectHolder Evaluate(Slot* slots, runtime::Closure& closure, runtime::Context& context) const;
+
+        std::unique_ptr<Statement> tree_;
+        std::vector<FlatNode> nodes_;
+        std::vector<runtime::ObjectHolder> constants_;
+        std::vector<runtime::Symbol> names_;
+        std::vector<Statement*> leaves_;
+        std::vector<const Comparison::Comparator*> comparators_;
+        // Values of the nodes during an evaluation
+        std::unique_ptr<Slot[]> slots_;
+        bool running_ = false;
+    };
+
+    // Appends nodes to a FlatExpression, each Statement::Flatten returns the index of its node
+    class FlatBuilder {
+    public:
+        // Without an expression the builder only counts the nodes
+        FlatBuilder() = default;
+
+        explicit FlatBuilder(FlatExpression& expression) : expression_(&expression) {}
+
+        uint32_t AddConstant(runtime::ObjectHolder value);
+
+        uint32_t AddVariable(runtime::Symbol name);
+
+        uint32_t AddLocal(size_t slot);
+
+        uint32_t AddLeaf(Statement& leaf);
+
+        uint32_t AddOperation(FlatOp op, uint32_t lhs, uint32_t rhs = 0);
+
+        uint32_t AddComparison(const Comparison::Comparator& cmp, uint32_t lhs, uint32_t rhs);
+
+        [[nodiscard]] size_t GetNodeCount() const;
+
+        [[nodiscard]] size_t GetOperationCount() const;
+    private:
+        uint32_t AddNode(FlatNode node);
+
+        FlatExpression* expression_ = nullptr;
+        size_t nodes_ = 0;
+        size_t operations_ = 0;
+    };
+
+}  // namespace ast
@@ -0,0 +1,239 @@
+#include "gc.h"
+
+#include <algorithm>
+#include <ostream>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+        thread_local CycleCollector* current_collector = nullptr;
+    }  // namespace
+
+    CycleCollector::CycleCollector(size_t threshold) : CycleCollector(CollectorMode::Full, threshold) {}
+
+    CycleCollector::CycleCollector(CollectorMode mode, size_t threshold)
+        : mode_(mode), threshold_(threshold), min_threshold_(threshold), major_threshold_(threshold) {
+    }
+
+    CycleCollector::~CycleCollector() {
+        this->Collect();
+        for (auto* head : { &this->young_, &this->old_ }) {
+            while (*head != nullptr) {
+                ClassInstance* instance = *head;
+                this->Untrack(*instance);
+                instance->collector_ = nullptr;
+            }
+        }
+    }
+
+    size_t CycleCollector::Collect() {
+        return this->Run(false);
+    }
+
+    size_t CycleCollector::CollectYoung() {
+        return this->Run(true);
+    }
+
+    size_t CycleCollector::Run(bool young_only) {
+        if (this->collecting_) {
+            return 0;
+        }
+        this->collecting_ = true;
+        const auto start = std::chrono::steady_clock::now();
+
+        ClassInstance* const heads[] = { this->young_, young_only ? nullptr : this->old_ };
+        auto for_each = [&heads](auto fn) {
+            for (auto* head : heads) {
+                for (auto* instance = head; instance != nullptr; instance = instance->gc_next_) {
+                    fn(*instance);
+                }
+            }
+        };
+        // Old instances are left out of a minor collection, so their fields count as outside references
+        auto collected = [this, young_only](const ObjectHolder& value) -> ClassInstance* {
+            auto* instance = value.TryAs<ClassInstance>();
+            if (instance == nullptr || instance->collector_ != this || (young_only && instance->gc_old_)) {
+                return nullptr;
+            }
+            return instance;
+        };
+
+        // References from outside of the collected fields. An instance that no holder owns
+        // (on the C++ stack, say) is referred to from the outside by definition
+        for_each([](ClassInstance& instance) {
+            instance.gc_refs_ = instance.GetRefCount() + (instance.IsOwned() ? 0 : 1);
+            instance.gc_reachable_ = false;
+        });
+        for_each([&collected](ClassInstance& instance) {
+            for (const auto& value : instance.values_) {
+                if (auto* target = collected(value)) {
+                    --target->gc_refs_;
+                }
+            }
+        });
+
+        std::vector<ClassInstance*> pending;
+        for_each([&pending](ClassInstance& instance) {
+            if (instance.gc_refs_ > 0 && !instance.gc_reachable_) {
+                instance.gc_reachable_ = true;
+                pending.push_back(&instance);
+            }
+        });
+        while (!pending.empty()) {
+            auto* instance = pending.back();
+            pending.pop_back();
+            for (const auto& value : instance->values_) {
+                auto* target = collected(value);
+                if (target != nullptr && !target->gc_reachable_) {
+                    target->gc_reachable_ = true;
+                    pending.push_back(target);
+                }
+            }
+        }
+
+        // The garbage is held while its fields are cleared, so the cycles come apart first
+        // and every instance is freed once, by its last holder
+        std::vector<ObjectHolder> garbage;
+        for_each([&garbage](ClassInstance& instance) {
+            if (!instance.gc_reachable_) {
+                garbage.push_back(ObjectHolder::Share(instance));
+            }
+        });
+        for (auto& holder : garbage) {
+            for (auto& value : holder.TryAs<ClassInstance>()->values_) {
+                value = ObjectHolder::None();
+            }
+        }
+        const size_t freed = garbage.size();
+        garbage.clear();
+
+        if (this->mode_ == CollectorMode::Generational) {
+            for (auto* instance = this->young_; instance != nullptr;) {
+                auto* next = instance->gc_next_;
+                if (++instance->gc_age_ >= PROMOTION_AGE) {
+                    this->Unlink(this->young_, *instance);
+                    instance->gc_old_ = true;
+                    this->Link(this->old_, *instance);
+                    this->old_count_++;
+                    this->stats_.promoted++;
+                }
+                instance = next;
+            }
+        }
+
+        const auto pause = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        this->stats_.collections++;
+        this->stats_.minor_collections += young_only;
+        this->stats_.freed += freed;
+        this->stats_.last_pause = pause;
+        this->stats_.max_pause = std::max(this->stats_.max_pause, pause);
+        this->stats_.total_pause += pause;
+
+        if (this->mode_ == CollectorMode::Full) {
+            // The next collection waits for as many new instances as survived, which keeps the work linear
+            this->threshold_ = std::max(this->min_threshold_, this->tracked_);
+        } else if (!young_only) {
+            // Minor collections keep the nursery size, a major one waits for the old generation to double
+            this->major_threshold_ = std::max(this->min_threshold_, 2 * this->old_count_);
+        }
+        this->created_ = 0;
+        this->collecting_ = false;
+        return freed;
+    }
+
+    CollectorMode CycleCollector::GetMode() const {
+        return this->mode_;
+    }
+
+    size_t CycleCollector::GetTrackedCount() const {
+        return this->tracked_;
+    }
+
+    size_t CycleCollector::GetOldCount() const {
+        return this->old_count_;
+    }
+
+    const CollectorStats& CycleCollector::GetStats() const {
+        return this->stats_;
+    }
+
+    void CycleCollector::DumpStats(std::ostream& os) const {
+        using std::chrono::microseconds;
+        const auto& stats = this->stats_;
+        os << "collector: " << (this->mode_ == CollectorMode::Full ? "full" : "generational")
+           << ", allocated: " << stats.allocated << ", tracked: " << this->tracked_ << ", old: " << this->old_count_ << "\n";
+        os << "collections: " << stats.collections << " (" << stats.minor_collections << " minor)"
+           << ", freed: " << stats.freed << ", promoted: " << stats.promoted << "\n";
+        if (stats.collections > 0) {
+            os << "pause, us: max " << std::chrono::duration_cast<microseconds>(stats.max_pause).count()
+               << ", mean " << std::chrono::duration_cast<microseconds>(stats.total_pause).count() / stats.collections
+               << ", total " << std::chrono::duration_cast<microseconds>(stats.total_pause).count() << "\n";
+        }
+    }
+
+    CycleCollector::Scope::Scope(CycleCollector& collector) : previous_(current_collector) {
+        current_collector = &collector;
+    }
+
+    CycleCollector::Scope::~Scope() {
+        current_collector = this->previous_;
+    }
+
+    CycleCollector* CycleCollector::Current() {
+        return current_collector;
+    }
+
+    void CycleCollector::Track(ClassInstance& instance) {
+        if (++this->created_ >= this->threshold_) {
+            if (this->mode_ == CollectorMode::Generational) {
+                this->CollectYoung();
+                if (this->old_count_ >= this->major_threshold_) {
+                    this->Collect();
+                }
+            } else {
+                this->Collect();
+            }
+        }
+        instance.collector_ = this;
+        instance.gc_old_ = false;
+        instance.gc_age_ = 0;
+        this->Link(this->young_, instance);
+        this->tracked_++;
+        this->stats_.allocated++;
+    }
+
+    void CycleCollector::Untrack(ClassInstance& instance) {
+        if (instance.gc_old_) {
+            this->Unlink(this->old_, instance);
+            this->old_count_--;
+        } else {
+            this->Unlink(this->young_, instance);
+        }
+        this->tracked_--;
+    }
+
+    void CycleCollector::Link(ClassInstance*& head, ClassInstance& instance) {
+        instance.gc_prev_ = nullptr;
+        instance.gc_next_ = head;
+        if (head != nullptr) {
+            head->gc_prev_ = &instance;
+        }
+        head = &instance;
+    }
+
+    void CycleCollector::Unlink(ClassInstance*& head, ClassInstance& instance) {
+        if (instance.gc_prev_ != nullptr) {
+            instance.gc_prev_->gc_next_ = instance.gc_next_;
+        } else {
+            head = instance.gc_next_;
+        }
+        if (instance.gc_next_ != nullptr) {
+            instance.gc_next_->gc_prev_ = instance.gc_prev_;
+        }
+        instance.gc_prev_ = nullptr;
+        instance.gc_next_ = nullptr;
+    }
+
+}  // namespace runtime
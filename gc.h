@@ -0,0 +1,115 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <chrono>
+#include <cstddef>
+#include <iosfwd>
+
+namespace runtime {
+
+    enum class CollectorMode {
+        // Every collection looks at all the tracked instances
+        Full,
+        // New instances are young. Minor collections look at the young ones only, the instances
+        // that survive a few of them are promoted to the old generation, which only a major
+        // collection looks at
+        Generational,
+    };
+
+    struct CollectorStats {
+        // Instances tracked since the collector was created
+        size_t allocated = 0;
+        size_t collections = 0;
+        // Collections of the young generation, also counted in collections
+        size_t minor_collections = 0;
+        size_t freed = 0;
+        size_t promoted = 0;
+        std::chrono::nanoseconds last_pause{ 0 };
+        std::chrono::nanoseconds max_pause{ 0 };
+        std::chrono::nanoseconds total_pause{ 0 };
+    };
+
+    // Frees the ClassInstances that only keep each other alive, like a.peer = b and b.peer = a.
+    // Instances created while a Scope is alive are tracked. The holders outside of the tracked
+    // instances (Closures, frames, the VM stack, C++ locals) are the roots: a collection finds them
+    // as the references that the fields of the tracked instances do not account for, traces the
+    // fields from them and frees the rest. Not thread-safe: one collector serves one interpreter
+    class CycleCollector {
+    public:
+        // A collection starts once this many instances were created since the previous one
+        static constexpr size_t DEFAULT_THRESHOLD = 10'000;
+
+        // Minor collections a young instance survives before it is promoted
+        static constexpr uint8_t PROMOTION_AGE = 2;
+
+        explicit CycleCollector(size_t threshold = DEFAULT_THRESHOLD);
+
+        explicit CycleCollector(CollectorMode mode, size_t threshold = DEFAULT_THRESHOLD);
+
+        CycleCollector(const CycleCollector&) = delete;
+        CycleCollector& operator=(const CycleCollector&) = delete;
+
+        // Frees the cycles that are left and stops tracking the surviving instances
+        ~CycleCollector();
+
+        // Collects both generations, returns the number of instances freed
+        size_t Collect();
+
+        // Collects the young generation only. References from old instances keep young ones alive
+        size_t CollectYoung();
+
+        [[nodiscard]] CollectorMode GetMode() const;
+
+        [[nodiscard]] size_t GetTrackedCount() const;
+
+        [[nodiscard]] size_t GetOldCount() const;
+
+        [[nodiscard]] const CollectorStats& GetStats() const;
+
+        void DumpStats(std::ostream& os) const;
+
+        // While a scope is alive, ClassInstances created on its thread are tracked by the collector
+        class Scope {
+        public:
+            explicit Scope(CycleCollector& collector);
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            ~Scope();
+        private:
+            CycleCollector* previous_;
+        };
+
+        // nullptr outside of any Scope
+        [[nodiscard]] static CycleCollector* Current();
+    private:
+        friend class ClassInstance;
+
+        // Called by the constructors of ClassInstance, may run a collection first
+        void Track(ClassInstance& instance);
+
+        void Untrack(ClassInstance& instance);
+
+        size_t Run(bool young_only);
+
+        void Link(ClassInstance*& head, ClassInstance& instance);
+
+        void Unlink(ClassInstance*& head, ClassInstance& instance);
+
+        CollectorMode mode_;
+        ClassInstance* young_ = nullptr;
+        ClassInstance* old_ = nullptr;
+        size_t tracked_ = 0;
+        size_t old_count_ = 0;
+        size_t threshold_;
+        size_t min_threshold_;
+        // Size of the old generation that starts a major collection
+        size_t major_threshold_;
+        size_t created_ = 0;
+        bool collecting_ = false;
+        CollectorStats stats_;
+    };
+
+}  // namespace runtime
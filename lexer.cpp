@@ -1,14 +1,182 @@
 #include "lexer.h"
 
 #include <algorithm>
+#include <array>
 #include <charconv>
+#include <fstream>
 #include <unordered_map>
 #include <iostream>
+#include <iterator>
+#include <atomic>
+#include <exception>
+#include <system_error>
+#include <thread>
+
+// Define MYTHON_LEXER_SCALAR to build the scanners without SIMD
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(MYTHON_LEXER_SCALAR)
+#include <emmintrin.h>
+#define MYTHON_LEXER_SSE2
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
 namespace parse {
 
+    namespace {
+        template <typename T, size_t I = 0>
+        constexpr size_t TokenIndex() {
+            if constexpr (std::is_same_v<std::variant_alternative_t<I, TokenBase>, T>) {
+                return I;
+            } else {
+                return TokenIndex<T, I + 1>();
+            }
+        }
+
+        template <size_t... I>
+        std::array<Token, sizeof...(I)> MakeBlankTokens(std::index_sequence<I...>) {
+            return { Token(std::in_place_index<I>)... };
+        }
+
+        // A token of each type with a default value, indexed by type
+        const auto BLANK_TOKENS = MakeBlankTokens(std::make_index_sequence<std::variant_size_v<TokenBase>>());
+
+        template <typename T>
+        Token MakeToken() {
+            return T{};
+        }
+
+        struct Keyword {
+            std::string_view text;
+            std::string_view type_name;
+            size_t index;
+            Token (*make)();
+        };
+
+#define KEYWORD_ENTRY(type, text) { text##sv, #type##sv, TokenIndex<token_type::type>(), &MakeToken<token_type::type> },
+        constexpr Keyword KEYWORDS[] = { MYTHON_KEYWORD_TOKENS(KEYWORD_ENTRY) };
+#undef KEYWORD_ENTRY
+
+        constexpr size_t KEYWORD_TABLE_SIZE = 32;
+
+        // Length, first and last character tell every keyword apart, see MakeKeywordTable
+        constexpr size_t KeywordHash(std::string_view text) {
+            return (text.size() * 31 + static_cast<unsigned char>(text.front()) * 12 + static_cast<unsigned char>(text.back())) % KEYWORD_TABLE_SIZE;
+        }
+
+        constexpr std::array<int8_t, KEYWORD_TABLE_SIZE> MakeKeywordTable() {
+            std::array<int8_t, KEYWORD_TABLE_SIZE> table{};
+            for (auto& slot : table) {
+                slot = -1;
+            }
+            for (size_t ptr = 0; ptr < std::size(KEYWORDS); ptr++) {
+                auto& slot = table[KeywordHash(KEYWORDS[ptr].text)];
+                if (slot != -1) {
+                    throw std::logic_error("Keyword hash collision");
+                }
+                slot = static_cast<int8_t>(ptr);
+            }
+            return table;
+        }
+
+        // Fails to compile when the hash stops being perfect for the keyword set
+        constexpr auto KEYWORD_TABLE = MakeKeywordTable();
+
+        // Character-class scanners: each returns the first position in [pos, end) that stops the
+        // run, or end. With SSE2 they test 16 bytes per step and finish the tail one byte at a time
+        bool IsIdChar(char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        }
+
+#ifdef MYTHON_LEXER_SSE2
+        // Bit i is set for every byte that does not belong to the run
+        template <typename Classify>
+        const char* ScanBlocks(const char* pos, const char* end, Classify classify) {
+            for (; end - pos >= 16; pos += 16) {
+                const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+                const unsigned stop = static_cast<unsigned>(_mm_movemask_epi8(classify(block)));
+                if (stop != 0) {
+                    return pos + __builtin_ctz(stop);
+                }
+            }
+            return pos;
+        }
+
+        __m128i InRange(__m128i block, char first, char last) {
+            return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(first - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8(last + 1)));
+        }
+#endif
+
+        const char* SkipSpaces(const char* pos, const char* end) {
+#ifdef MYTHON_LEXER_SSE2
+            pos = ScanBlocks(pos, end, [](__m128i block) {
+                return _mm_xor_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), _mm_set1_epi8(-1));
+            });
+#endif
+            while (pos != end && *pos == ' ') {
+                ++pos;
+            }
+            return pos;
+        }
+
+        const char* SkipDigits(const char* pos, const char* end) {
+#ifdef MYTHON_LEXER_SSE2
+            pos = ScanBlocks(pos, end, [](__m128i block) {
+                return _mm_xor_si128(InRange(block, '0', '9'), _mm_set1_epi8(-1));
+            });
+#endif
+            while (pos != end && *pos >= '0' && *pos <= '9') {
+                ++pos;
+            }
+            return pos;
+        }
+
+        const char* SkipIdChars(const char* pos, const char* end) {
+#ifdef MYTHON_LEXER_SSE2
+            pos = ScanBlocks(pos, end, [](__m128i block) {
+                const __m128i lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+                const __m128i id = _mm_or_si128(_mm_or_si128(InRange(lower, 'a', 'z'), InRange(block, '0', '9')),
+                    _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+                return _mm_xor_si128(id, _mm_set1_epi8(-1));
+            });
+#endif
+            while (pos != end && IsIdChar(*pos)) {
+                ++pos;
+            }
+            return pos;
+        }
+
+        // Stops at the closing quote, an escape or a carriage return
+        const char* FindStringStop(const char* pos, const char* end, char quote) {
+#ifdef MYTHON_LEXER_SSE2
+            pos = ScanBlocks(pos, end, [quote](__m128i block) {
+                return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(quote)), _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))),
+                    _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')));
+            });
+#endif
+            while (pos != end && *pos != quote && *pos != '\\' && *pos != '\r') {
+                ++pos;
+            }
+            return pos;
+        }
+    }  // namespace
+
+    Token Lexer::LoadId(std::string_view input) {
+        if (!input.empty()) {
+            const int8_t index = KEYWORD_TABLE[KeywordHash(input)];
+            if (index != -1 && KEYWORDS[index].text == input) {
+                return KEYWORDS[index].make();
+            }
+        }
+        return token_type::Id{ input };
+    }
+
     bool operator==(const Token& lhs, const Token& rhs) {
         using namespace token_type;
 
@@ -47,135 +215,421 @@ namespace parse {
 
 #undef VALUED_OUTPUT
 
-#define UNVALUED_OUTPUT(type) \
-    if (rhs.Is<type>()) return os << #type;
-
-        UNVALUED_OUTPUT(Class);
-        UNVALUED_OUTPUT(Return);
-        UNVALUED_OUTPUT(If);
-        UNVALUED_OUTPUT(Else);
-        UNVALUED_OUTPUT(Def);
-        UNVALUED_OUTPUT(Newline);
-        UNVALUED_OUTPUT(Print);
-        UNVALUED_OUTPUT(Indent);
-        UNVALUED_OUTPUT(Dedent);
-        UNVALUED_OUTPUT(And);
-        UNVALUED_OUTPUT(Or);
-        UNVALUED_OUTPUT(Not);
-        UNVALUED_OUTPUT(Eq);
-        UNVALUED_OUTPUT(NotEq);
-        UNVALUED_OUTPUT(LessOrEq);
-        UNVALUED_OUTPUT(GreaterOrEq);
-        UNVALUED_OUTPUT(None);
-        UNVALUED_OUTPUT(True);
-        UNVALUED_OUTPUT(False);
-        UNVALUED_OUTPUT(Eof);
-
-#undef UNVALUED_OUTPUT
+        for (const auto& keyword : KEYWORDS) {
+            if (rhs.index() == keyword.index) {
+                return os << keyword.type_name;
+            }
+        }
 
         return os << "Unknown token :("sv;
     }
 
-    Lexer::Lexer(std::istream& input) : token_ctr_(0) {
-        int last_sps = 0;
-        int now_sps = 0;
-        string line;
-        while (!input.eof()) {
-            std::getline(input, line);
-            if (line.empty()) {
-                continue;
+    void TokenStore::Push(const Token& token) {
+        using namespace token_type;
+
+        uint32_t payload = 0;
+        if (const auto* num = token.TryAs<Number>()) {
+            payload = static_cast<uint32_t>(num->value);
+        } else if (const auto* ch = token.TryAs<Char>()) {
+            payload = static_cast<unsigned char>(ch->value);
+        } else if (const auto* id = token.TryAs<Id>()) {
+            payload = static_cast<uint32_t>(this->ids_.size());
+            this->ids_.push_back(id->value);
+        } else if (const auto* str = token.TryAs<String>()) {
+            payload = static_cast<uint32_t>(this->strings_.size());
+            this->strings_.push_back(str->value);
+        }
+        this->kinds_.push_back(static_cast<uint8_t>(token.index()));
+        this->payloads_.push_back(payload);
+    }
+
+    Token TokenStore::Get(size_t index) const {
+        using namespace token_type;
+
+        const uint32_t payload = this->payloads_[index];
+        switch (this->kinds_[index]) {
+        case TokenIndex<Number>():
+            return Number{ static_cast<int>(payload) };
+        case TokenIndex<Char>():
+            return Char{ static_cast<char>(payload) };
+        case TokenIndex<Id>():
+            return Id{ this->ids_[payload] };
+        case TokenIndex<String>():
+            return String{ this->strings_[payload] };
+        default:
+            return BLANK_TOKENS[this->kinds_[index]];
+        }
+    }
+
+    size_t TokenStore::Size() const {
+        return this->kinds_.size();
+    }
+
+    bool TokenStore::Empty() const {
+        return this->kinds_.empty();
+    }
+
+    void TokenStore::Reserve(size_t count) {
+        this->kinds_.reserve(count);
+        this->payloads_.reserve(count);
+    }
+
+    void TokenStore::Clear() {
+        this->kinds_.clear();
+        this->payloads_.clear();
+        this->ids_.clear();
+        this->strings_.clear();
+    }
+
+    void TokenStore::Append(const TokenStore& other) {
+        const auto ids = static_cast<uint32_t>(this->ids_.size());
+        const auto strings = static_cast<uint32_t>(this->strings_.size());
+        for (size_t ptr = 0; ptr < other.Size(); ptr++) {
+            const uint8_t kind = other.kinds_[ptr];
+            uint32_t payload = other.payloads_[ptr];
+            if (kind == TokenIndex<token_type::Id>()) {
+                payload += ids;
+            } else if (kind == TokenIndex<token_type::String>()) {
+                payload += strings;
             }
-            if (this->LineEmpty(line)) {
-                continue;
+            this->kinds_.push_back(kind);
+            this->payloads_.push_back(payload);
+        }
+        this->ids_.insert(this->ids_.end(), other.ids_.begin(), other.ids_.end());
+        this->strings_.insert(this->strings_.end(), other.strings_.begin(), other.strings_.end());
+    }
+
+    Source::Source(std::shared_ptr<const void> owner, std::string_view text) : owner_(std::move(owner)), text_(text) {}
+
+    Source Source::Borrow(std::string_view text) {
+        return Source(nullptr, text);
+    }
+
+    Source Source::Read(std::istream& input) {
+        auto text = std::make_shared<const std::string>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        return Source(text, *text);
+    }
+
+    Source Source::Map(const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw LexerError("Can not open " + path);
+        }
+        struct stat info {};
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw LexerError("Can not open " + path);
+        }
+        const size_t size = static_cast<size_t>(info.st_size);
+        if (size == 0) {
+            ::close(fd);
+            return Borrow({});
+        }
+        void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            throw LexerError("Can not map " + path);
+        }
+        std::shared_ptr<const void> owner(data, [size](const void* ptr) {
+            ::munmap(const_cast<void*>(ptr), size);
+        });
+        return Source(std::move(owner), std::string_view(static_cast<const char*>(data), size));
+#else
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            throw LexerError("Can not open " + path);
+        }
+        return Read(input);
+#endif
+    }
+
+    std::string_view Source::Text() const {
+        return this->text_;
+    }
+
+    Lexer::Lexer(std::istream& input) : Lexer(Source::Read(input)) {}
+
+    Lexer::Lexer(std::istream& input, LexerMode mode) : token_ctr_(0), mode_(mode) {
+        if (mode == LexerMode::Eager) {
+            this->source_ = Source::Read(input);
+            this->Tokenize(this->source_.Text());
+        } else if (mode == LexerMode::Parallel) {
+            this->source_ = Source::Read(input);
+            this->TokenizeParallel(this->source_.Text(), DEFAULT_CHUNK_SIZE);
+        } else {
+            this->input_ = &input;
+            this->Refill();
+        }
+        this->current_ = this->root_.Get(0);
+    }
+
+    Lexer::Lexer(Source source, LexerMode mode, size_t chunk_size) : source_(std::move(source)), token_ctr_(0), mode_(mode) {
+        if (mode == LexerMode::Eager) {
+            this->Tokenize(this->source_.Text());
+        } else if (mode == LexerMode::Parallel) {
+            this->TokenizeParallel(this->source_.Text(), chunk_size);
+        } else {
+            this->rest_ = this->source_.Text();
+            this->Refill();
+        }
+        this->current_ = this->root_.Get(0);
+    }
+
+    Lexer::Lexer(ChunkTag, std::string_view text) : last_sps_(-1) {
+        this->root_.Reserve(text.size() / 4 + 2);
+        this->TokenizeLines(text);
+    }
+
+    void Lexer::Tokenize(std::string_view text) {
+        // Generated sources average a token per four to eight bytes
+        this->root_.Reserve(text.size() / 4 + 2);
+        this->TokenizeLines(text);
+        this->Finish();
+    }
+
+    void Lexer::TokenizeLines(std::string_view text) {
+        while (!text.empty()) {
+            const size_t line_end = text.find('\n');
+            this->TokenizeSourceLine(text.substr(0, line_end));
+            text.remove_prefix(line_end == std::string_view::npos ? text.size() : line_end + 1);
+        }
+    }
+
+    void Lexer::TokenizeParallel(std::string_view text, size_t chunk_size) {
+        std::vector<std::string_view> parts;
+        while (text.size() > chunk_size) {
+            const size_t line_end = text.find('\n', chunk_size);
+            if (line_end == std::string_view::npos) {
+                break;
             }
+            parts.push_back(text.substr(0, line_end + 1));
+            text.remove_prefix(line_end + 1);
+        }
+        if (parts.empty()) {
+            this->Tokenize(text);
+            return;
+        }
+        if (!text.empty()) {
+            parts.push_back(text);
+        }
 
-            now_sps = 0;
-            if (line[0] == 32) {
-                int ptr = 0;
-                while (line[ptr++] == 32) {
-                    now_sps++;
+        // Workers take the next chunk until none is left, errors are raised in chunk order below
+        std::vector<std::unique_ptr<Lexer>> chunks(parts.size());
+        std::vector<std::exception_ptr> errors(parts.size());
+        std::atomic<size_t> next = 0;
+        auto work = [&] {
+            for (size_t ptr = next++; ptr < parts.size(); ptr = next++) {
+                try {
+                    chunks[ptr].reset(new Lexer(ChunkTag{}, parts[ptr]));
+                } catch (...) {
+                    errors[ptr] = std::current_exception();
                 }
             }
-            this->IndentDedentParser(now_sps, last_sps);
-            last_sps = now_sps;
+        };
+        const size_t workers = std::min<size_t>(parts.size(), std::max(std::thread::hardware_concurrency(), 1U));
+        std::vector<std::thread> threads;
+        for (size_t ptr = 1; ptr < workers; ptr++) {
+            try {
+                threads.emplace_back(work);
+            } catch (const std::system_error&) {
+                break;
+            }
+        }
+        work();
+        for (auto& thread : threads) {
+            thread.join();
+        }
 
-            stringstream ss;
-            ss << line;
-            char ch;
-            while (!ss.eof()) {
-                if (ss.peek() == ' ') {
-                    ss >> std::noskipws >> ch;
-                }
-                if (ss.peek() == '#') {
-                    break;
-                }
-                if (this->IsNumber(ss.peek())) {
-                    this->root_.push_back(this->LoadNumber(this->ReadNumber(ss)));
-                }
-                if (ss.peek() == '\'' || ss.peek() == '\"') {
-                    this->root_.push_back(this->LoadString(this->ReadString(ss)));
-                }
-                if (this->IsAlphabet(ss.peek())) {
-                    this->root_.push_back(this->LoadId(this->ReadId(ss)));
-                }
-                if (this->IsChar(ss.peek())) {
-                    if (ss.peek() == '=') {
-                        ss >> ch;
-                        if (ss.peek() == '=') {
-                            this->root_.push_back(this->LoadId("=="));
-                            ss >> ch;
-                        } else {
-                            this->root_.push_back(this->LoadChar(ch));
-                        }
-                    } else if (ss.peek() == '!') {
-                        ss >> ch;
-                        if (ss.peek() == '=') {
-                            this->root_.push_back(this->LoadId("!="));
-                            ss >> ch;
-                        } else {
-                            this->root_.push_back(this->LoadChar(ch));
-                        }
-                    } else if (ss.peek() == '>') {
-                        ss >> ch;
-                        if (ss.peek() == '=') {
-                            this->root_.push_back(this->LoadId(">="));
-                            ss >> ch;
-                        } else {
-                            this->root_.push_back(this->LoadChar(ch));
-                        }
-                    } else if (ss.peek() == '<') {
-                        ss >> ch;
-                        if (ss.peek() == '=') {
-                            this->root_.push_back(this->LoadId("<="));
-                            ss >> ch;
-                        } else {
-                            this->root_.push_back(this->LoadChar(ch));
-                        }
-                    } else {
-                        this->root_.push_back(this->LoadChar(ss.peek()));
-                        ss >> std::noskipws >> ch;
-                    }
+        size_t size = 1;
+        for (const auto& chunk : chunks) {
+            size += chunk ? chunk->root_.Size() : 0;
+        }
+        this->root_.Reserve(size);
+        for (size_t ptr = 0; ptr < parts.size(); ptr++) {
+            if (errors[ptr]) {
+                std::rethrow_exception(errors[ptr]);
+            }
+            this->AppendChunk(*chunks[ptr]);
+        }
+        this->Finish();
+    }
+
+    void Lexer::AppendChunk(Lexer& chunk) {
+        if (chunk.first_sps_ != -1) {
+            this->IndentDedentParser(chunk.first_sps_, this->last_sps_);
+            this->last_sps_ = chunk.last_sps_;
+        }
+        this->root_.Append(chunk.root_);
+        // Moving a deque keeps its elements in place, so the views in the tokens stay valid
+        this->chunk_unescaped_.push_back(std::move(chunk.unescaped_));
+    }
+
+    bool Lexer::TokenizeSourceLine(std::string_view line) {
+        const char* pos = line.data();
+        const char* const end = pos + line.size();
+        const char* first = SkipSpaces(pos, end);
+        if (first == end || *first == '#') {
+            return false;
+        }
+        int now_sps = static_cast<int>(first - pos);
+        if (this->last_sps_ == -1) {
+            this->first_sps_ = now_sps;
+        } else {
+            this->IndentDedentParser(now_sps, this->last_sps_);
+        }
+        this->last_sps_ = now_sps;
+        this->TokenizeLine(first, end);
+        this->root_.Push(token_type::Newline());
+        return true;
+    }
+
+    void Lexer::Finish() {
+        this->IndentDedentParser(0, this->last_sps_);
+        this->root_.Push(token_type::Eof());
+        this->finished_ = true;
+    }
+
+    void Lexer::Refill() {
+        this->root_.Clear();
+        this->unescaped_.clear();
+        this->token_ctr_ = 0;
+        std::string_view line;
+        while (this->root_.Empty()) {
+            if (!this->ReadLine(line)) {
+                this->Finish();
+                return;
+            }
+            this->TokenizeSourceLine(line);
+        }
+    }
+
+    bool Lexer::ReadLine(std::string_view& line) {
+        if (this->input_ != nullptr) {
+            if (!std::getline(*this->input_, this->line_)) {
+                return false;
+            }
+            line = this->line_;
+            return true;
+        }
+        if (this->rest_.empty()) {
+            return false;
+        }
+        const size_t line_end = this->rest_.find('\n');
+        line = this->rest_.substr(0, line_end);
+        this->rest_.remove_prefix(line_end == std::string_view::npos ? this->rest_.size() : line_end + 1);
+        return true;
+    }
+
+    void Lexer::TokenizeLine(const char* pos, const char* end) {
+        while (pos != end) {
+            const char ch = *pos;
+            if (ch == ' ') {
+                pos = SkipSpaces(pos, end);
+            } else if (ch == '#') {
+                break;
+            } else if (this->IsNumber(ch)) {
+                pos = this->ReadNumber(pos, end);
+            } else if (ch == '\'' || ch == '\"') {
+                pos = this->ReadString(pos, end);
+            } else if (this->IsAlphabet(ch)) {
+                pos = this->ReadId(pos, end);
+            } else if (this->IsChar(ch)) {
+                ++pos;
+                if ((ch == '=' || ch == '!' || ch == '<' || ch == '>') && pos != end && *pos == '=') {
+                    this->root_.Push(this->LoadId(std::string_view(pos - 1, 2)));
+                    ++pos;
+                } else {
+                    this->root_.Push(this->LoadChar(ch));
                 }
+            } else {
+                throw LexerError("Unexpected character '"s + ch + "'"s);
             }
-            this->root_.push_back(Token(token_type::Newline()));
         }
-        this->IndentDedentParser(0, last_sps);
-        this->root_.push_back(Token(token_type::Eof()));
     }
 
-    const Token& Lexer::CurrentToken() const {
-        if (this->token_ctr_ < this->root_.size()) {
-            return this->root_[this->token_ctr_];
+    const char* Lexer::ReadNumber(const char* pos, const char* end) {
+        const char* last = SkipDigits(pos, end);
+        int value = 0;
+        if (std::from_chars(pos, last, value).ec != std::errc()) {
+            throw std::out_of_range("Number is out of range");
         }
+        this->root_.Push(token_type::Number{ value });
+        return last;
+    }
+
+    const char* Lexer::ReadString(const char* pos, const char* end) {
+        const char quote = *pos++;
+        const char* first = pos;
+        std::string* unescaped = nullptr;
+        for (;; ++pos) {
+            const char* stop = FindStringStop(pos, end, quote);
+            if (unescaped != nullptr) {
+                unescaped->append(pos, stop);
+            }
+            pos = stop;
+            if (pos == end || *pos == '\r') {
+                throw LexerError("Unexpected end of line");
+            }
+            if (*pos == quote) {
+                break;
+            }
+            if (unescaped == nullptr) {
+                unescaped = &this->unescaped_.emplace_back(first, pos);
+            }
+            if (++pos == end) {
+                throw LexerError("Unexpected end of line");
+            }
+            switch (*pos) {
+            case 'n':
+                unescaped->push_back('\n');
+                break;
+            case 't':
+                unescaped->push_back('\t');
+                break;
+            case '"':
+            case '\'':
+            case '\\':
+                unescaped->push_back(*pos);
+                break;
+            default:
+                throw LexerError("Unrecognized escape sequence \\"s + *pos);
+            }
+        }
+        if (unescaped == nullptr) {
+            this->root_.Push(token_type::String{ std::string_view(first, pos - first) });
+        } else {
+            // Escaped strings with a pair of quotes lose their backslashes, as they always did
+            auto& value = *unescaped;
+            if (value.find_first_of('\'') != value.find_last_of('\'') || value.find_first_of('\"') != value.find_last_of('\"')) {
+                value.erase(std::remove(value.begin(), value.end(), '\\'), value.end());
+            }
+            this->root_.Push(token_type::String{ value });
+        }
+        return pos + 1;
+    }
+
+    const char* Lexer::ReadId(const char* pos, const char* end) {
+        const char* last = SkipIdChars(pos, end);
+        this->root_.Push(this->LoadId(std::string_view(pos, last - pos)));
+        return last;
+    }
+
+    const Token& Lexer::CurrentToken() const {
+        return this->current_;
     }
 
     Token Lexer::NextToken() {
         this->token_ctr_++;
-        if (this->token_ctr_ < this->root_.size()) {
-            return this->root_[this->token_ctr_];
+        if (this->token_ctr_ >= this->root_.Size() && this->mode_ == LexerMode::Streaming && !this->finished_) {
+            this->Refill();
+        }
+        if (this->token_ctr_ < this->root_.Size()) {
+            this->current_ = this->root_.Get(this->token_ctr_);
         } else {
-            return Token(token_type::Eof());
+            this->current_ = token_type::Eof();
         }
+        return this->current_;
     }
 
 }  // namespace parse
\ No newline at end of file
@@ -1,13 +1,19 @@
 #pragma once
 
+#include "symbol.h"
+
+#include <deque>
 #include <iosfwd>
+#include <memory>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 #include <algorithm>
+#include <cstdint>
 
 namespace parse {
 
@@ -16,16 +22,19 @@ namespace parse {
             int value;
         };
 
+        // Identifiers are interned as they are lexed and outlive the lexer
         struct Id {
-            std::string value;
+            runtime::Symbol value;
         };
 
         struct Char {
             char value;
         };
 
+        // String values point into the Source of the lexer, or into its pool of unescaped
+        // strings, and live as long as the lexer
         struct String {
-            std::string value;
+            std::string_view value;
         };
 
         struct Class {};    
@@ -50,6 +59,32 @@ namespace parse {
         struct False {};
     }  // namespace token_type
 
+    // Token types without a value and their spellings. The lexer recognizes keywords with a
+    // perfect hash built from this table and operator<< prints the type names from it
+#define MYTHON_KEYWORD_TOKENS(X) \
+    X(Class, "class")            \
+    X(Return, "return")          \
+    X(If, "if")                  \
+    X(Else, "else")              \
+    X(Def, "def")                \
+    X(Newline, "\n")             \
+    X(Print, "print")            \
+    X(Indent, "ident")           \
+    X(Dedent, "dedent")          \
+    X(And, "&&")                 \
+    X(And, "and")                \
+    X(Or, "||")                  \
+    X(Or, "or")                  \
+    X(Not, "not")                \
+    X(Eq, "==")                  \
+    X(NotEq, "!=")               \
+    X(LessOrEq, "<=")            \
+    X(GreaterOrEq, ">=")         \
+    X(None, "None")              \
+    X(True, "True")              \
+    X(False, "False")            \
+    X(Eof, "eof")
+
     using TokenBase
         = std::variant<token_type::Number, token_type::Id, token_type::Char, token_type::String,
         token_type::Class, token_type::Return, token_type::If, token_type::Else,
@@ -87,10 +122,79 @@ namespace parse {
         using std::runtime_error::runtime_error;
     };
 
+    // Token sequence stored as parallel arrays: a kind byte and a 32-bit payload per token.
+    // Numbers and chars live in the payload, Ids and Strings index their pools. Tokens are
+    // rebuilt on access
+    class TokenStore {
+    public:
+        void Push(const Token& token);
+
+        [[nodiscard]] Token Get(size_t index) const;
+
+        [[nodiscard]] size_t Size() const;
+
+        [[nodiscard]] bool Empty() const;
+
+        void Reserve(size_t count);
+
+        void Clear();
+
+        void Append(const TokenStore& other);
+    private:
+        std::vector<uint8_t> kinds_;
+        std::vector<uint32_t> payloads_;
+        std::vector<runtime::Symbol> ids_;
+        std::vector<std::string_view> strings_;
+    };
+
+    // Contiguous source text for the lexer: a borrowed buffer, a copy of a stream or a
+    // memory-mapped file. Copies share the text
+    class Source {
+    public:
+        Source() = default;
+
+        // The buffer must outlive the lexer and its tokens
+        [[nodiscard]] static Source Borrow(std::string_view text);
+
+        [[nodiscard]] static Source Read(std::istream& input);
+
+        // Maps the file where mmap is available and reads it otherwise
+        [[nodiscard]] static Source Map(const std::string& path);
+
+        [[nodiscard]] std::string_view Text() const;
+    private:
+        Source(std::shared_ptr<const void> owner, std::string_view text);
+
+        std::shared_ptr<const void> owner_;
+        std::string_view text_;
+    };
+
+    // Eager tokenizes the whole input up front. Streaming reads one line at a time when the
+    // parser runs out of tokens: only the tokens of the current line are buffered, and the
+    // values of String tokens live until the lexer moves past their line
+    enum class LexerMode {
+        Eager,
+        Streaming,
+        // Eager, with the source split at line boundaries into chunks tokenized on a pool of
+        // threads. Gives the same tokens as Eager
+        Parallel,
+    };
+
     class Lexer {
     public:
+        // Approximate size of a chunk of the Parallel mode
+        static constexpr size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+
         explicit Lexer(std::istream& input);
 
+        // A streaming lexer reads the stream as it goes, the stream must outlive it
+        Lexer(std::istream& input, LexerMode mode);
+
+        explicit Lexer(Source source, LexerMode mode = LexerMode::Eager, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+        Lexer(const Lexer&) = delete;
+        Lexer& operator=(const Lexer&) = delete;
+
         [[nodiscard]] const Token& CurrentToken() const;
 
         Token NextToken();
@@ -107,78 +211,63 @@ namespace parse {
         template <typename T, typename U>
         void Expect(const U& value) const {
             using namespace std::literals;
-            this->Expect<T>();
-            if ((this->root_[this->token_ctr_].As<T>().value != value)) {
+            if ((this->Expect<T>().value != value)) {
                 throw LexerError("Lexer part error in values");
             }
         }
 
         template <typename T>
         const T& ExpectNext() {
-            using namespace std::literals;
-            this->token_ctr_++;
-            if (this->token_ctr_ < this->root_.size()) {
-                return this->Expect<T>();
-            }
+            this->NextToken();
+            return this->Expect<T>();
         }
 
         template <typename T, typename U>
         void ExpectNext(const U& value) {
-            using namespace std::literals;
-            this->token_ctr_++;
-            if (this->token_ctr_ < this->root_.size()) {
-                return this->Expect<T>(value);
-            }
+            this->NextToken();
+            this->Expect<T>(value);
         }
 
     private:
-        bool LineEmpty(const std::string& s) {
-            for (const auto& c : s) {
-                if (c != ' ' && c != '#'){
-                    return false;
-                }
-                if (c == '#') {
-                    break;
-                }
-            }
-            return true;
-        }
+        struct ChunkTag {};
 
-        bool IsAlphabet(const char& c) {
-            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_')) {
-                return true;
-            }
-            return false;
-        }
+        // Lexer of one chunk of the Parallel mode. The indentation of its first line is left
+        // to AppendChunk, which knows the indentation of the chunk before
+        Lexer(ChunkTag, std::string_view text);
 
-        bool IsNumber(const std::string& s) {
-            std::string::const_iterator it = s.begin();
-            s[0] == '-' ? it += 1 : it += 0;
-            while (it != s.end() && std::isdigit(*it)) ++it;
-            return !s.empty() && it == s.end();
-        }
+        void Tokenize(std::string_view text);
 
-        bool IsNumber(const char& c) {
-            return std::isdigit(c);
-        }
+        void TokenizeLines(std::string_view text);
+
+        void TokenizeParallel(std::string_view text, size_t chunk_size);
+
+        void AppendChunk(Lexer& chunk);
+
+        // Appends the tokens of one source line, returns false for a blank line
+        bool TokenizeSourceLine(std::string_view line);
 
-        bool IsOperation(const std::string& c) {
-            if (c == "==" || c == ">=" || c == "<=" || c == "!="){
+        // Appends the closing dedents and Eof
+        void Finish();
+
+        // Streaming mode: replaces the buffered tokens with the ones of the next nonblank line
+        void Refill();
+
+        bool ReadLine(std::string_view& line);
+
+        void TokenizeLine(const char* pos, const char* end);
+
+        static bool IsAlphabet(char c) {
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_')) {
                 return true;
             }
             return false;
         }
 
-        bool IsChar(const std::string& c) {
-            if (c == "." || c == "," || c == "(" || c == "+" || c == ")" || c == "-" || c == "*" || c == "/" || c == ":"
-                || c == "@" || c == "%" || c == "$" || c == "^" || c == "&" || c == ";" || c == "?" || c == "=" || c == "<"
-                || c == ">" || c == "!" || c == "{" || c == "}" || c == "[" || c == "]") {
-                return true;
-            }
-            return false;
+        static bool IsNumber(char c) {
+            return c >= '0' && c <= '9';
         }
 
-        bool IsChar(const char c) {
+        static bool IsChar(const char c) {
             if (c == '.' || c == ',' || c == '(' || c == '+' || c == ')' || c == '-' || c == '*' || c == '/' || c == ':'
                 || c == '@' || c == '%' || c == '$' || c == '^' || c == '&' || c == ';' || c == '?' || c == '=' || c == '<'
                 || c == '>' || c == '!' || c == '{' || c == '}' || c == '[' || c == ']') {
@@ -187,78 +276,12 @@ namespace parse {
             return false;
         }
 
-        std::string ReadNumber(std::istream& input) {
-            char ch;
-            std::string num;
-            while (this->IsNumber(input.peek())) {
-                input >> ch;
-                num += ch;
-            }
-            return num;
-        }
-
-        std::string ReadString(std::istream& input) {
-            std::string result;
-            char quote;
-            input >> std::noskipws >> quote;
-            char ch;
-            while (true) {
-                if (input >> std::noskipws >> ch) {
-                    if (ch == quote) {
-                        break;
-                    } else if (ch == '\\') {
-                        char escaped_char;
-                        if (input >> escaped_char) {
-                            switch (escaped_char) {
-                            case 'n':
-                                result.push_back('\n');
-                                break;
-                            case 't':
-                                result.push_back('\t');
-                                break;
-                            case '"':
-                                result.push_back('"');
-                                break;
-                            case '\'':
-                                result.push_back('\'');
-                                break;
-                            case '\\':
-                                result.push_back('\\');
-                                break;
-                            default:
-                                throw LexerError("Unrecognized escape sequence \\" + escaped_char);
-                            }
-                        } else {
-                            throw LexerError("Unexpected end of line");
-                        }
-                    } else if (ch == '\n' || ch == '\r') {
-                        throw LexerError("Unexpected end of line");
-                    } else {
-                        result.push_back(ch);
-                    }
-                } else {
-                    throw LexerError("Unexpected end of line");
-                }
-            }
-            return result;
-        }
+        // Scanners take the position of the first character and return the one past the token
+        const char* ReadNumber(const char* pos, const char* end);
 
-        std::string ReadId(std::istream& input) {
-            char ch;
-            std::string id;
-            while (this->IsAlphabet(input.peek()) || this->IsNumber(input.peek())) {
-                input >> ch;
-                id += ch;
-            }
-            return id;
-        }
+        const char* ReadString(const char* pos, const char* end);
 
-        std::string ReadCharOperation(std::istream& input) {
-            char ch;
-            input >> ch;
-            std::string id;
-            return id;
-        }
+        const char* ReadId(const char* pos, const char* end);
 
         void IndentDedentParser(int now, int last) {
             if (now > last) {
@@ -266,7 +289,7 @@ namespace parse {
                     return;
                 }
                 while (now > last) {
-                    this->root_.push_back( { (token_type::Indent()) });
+                    this->root_.Push(token_type::Indent());
                     now -= 2;
                 }
             } else if (last > now) {
@@ -274,104 +297,40 @@ namespace parse {
                     return;
                 }
                 while (last > now) {
-                    this->root_.push_back({ (token_type::Dedent()) });
+                    this->root_.Push(token_type::Dedent());
                     last -= 2;
                 }
             }
             return;
         }
 
-        Token LoadNumber(const std::string input) {
-            token_type::Number token = { std::stoi(input) };
-            return token;
-        }
-
-        Token LoadString(const std::string& input) {
-            std::string tmp_in = input;
-            if (tmp_in.find_first_of('\'') != tmp_in.find_last_of('\'')) {
-                tmp_in.erase(std::remove(tmp_in.begin(), tmp_in.end(), '\\'), tmp_in.end());
-            }
-            if (tmp_in.find_first_of('\"') != tmp_in.find_last_of('\"')) {
-                tmp_in.erase(std::remove(tmp_in.begin(), tmp_in.end(), '\\'), tmp_in.end());
-            }
-            token_type::String token = { tmp_in };
-            return token;
-        }
-
         Token LoadChar(const char& input) {
             token_type::Char token = { input };
             return token;
         }
 
-        Token LoadId(const std::string& input) {
-            if (input == "class") {
-                token_type::Class token = {};
-                return token;
-            } else if (input == "if") {
-                token_type::If token = {};
-                return token;
-            } else if (input == "else") {
-                token_type::Else token = {};
-                return token;
-            } else if (input == "def") {
-                token_type::Def token = {};
-                return token;
-            } else if (input == "\n") {
-                token_type::Newline token = {};
-                return token;
-            } else if (input == "print") {
-                token_type::Print token = {};
-                return token;
-            } else if (input == "ident") {
-                token_type::Indent token = {};
-                return token;
-            } else if (input == "dedent") {
-                token_type::Dedent token = {};
-                return token;
-            } else if (input == "&&" || input == "and") {
-                token_type::And token = {};
-                return token;
-            } else if (input == "||" || input == "or") {
-                token_type::Or token = {};
-                return token;
-            } else if (input == "not") {
-                token_type::Not token = {};
-                return token;
-            } else if (input == "==") {
-                token_type::Eq token = {};
-                return token;
-            } else if (input == "!=") {
-                token_type::NotEq token = {};
-                return token;
-            } else if (input == "<=") {
-                token_type::LessOrEq token = {};
-                return token;
-            } else if (input == ">=") {
-                token_type::GreaterOrEq token = {};
-                return token;
-            } else if (input == "None") {
-                token_type::None token = {};
-                return token;
-            } else if (input == "True") {
-                token_type::True token = {};
-                return token;
-            } else if (input == "False") {
-                token_type::False token = {};
-                return token;
-            } else if (input == "eof") {
-                token_type::Eof token = {};
-                return token;
-            } else if (input == "return") {
-                token_type::Return token = {};
-                return token;
-            } else {
-                token_type::Id token = {input};
-                return token;
-            }
-        }
+        // Keywords and two-character operators get their own token type, anything else is an Id
+        static Token LoadId(std::string_view input);
 
+        Source source_;
+        // Strings with escape sequences differ from their source text and are kept here
+        std::deque<std::string> unescaped_;
+        // Unescaped strings of the chunks of the Parallel mode
+        std::vector<std::deque<std::string>> chunk_unescaped_;
         size_t token_ctr_ = 0;
-        std::vector<Token> root_;
+        TokenStore root_;
+        // The token at token_ctr_, CurrentToken hands out references to it
+        Token current_ = token_type::Eof();
+        int last_sps_ = 0;
+        // Indentation of the first nonblank line of a chunk, -1 when it has none
+        int first_sps_ = -1;
+
+        // Streaming state: the stream or the rest of the source still to read
+        LexerMode mode_ = LexerMode::Eager;
+        std::istream* input_ = nullptr;
+        std::string line_;
+        std::string_view rest_;
+        bool finished_ = false;
     };
 
 }  // namespace parse
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include "lexer.h"
+#include "test_runner_p.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+namespace parse {
+
+    namespace {
+        bool PointsInto(string_view value, string_view text) {
+            return value.data() >= text.data() && value.data() + value.size() <= text.data() + text.size();
+        }
+
+        void TestBorrowedSource() {
+            const string text = "x = 'plain'\ny = 'esc\\'aped'\n"s;
+            Lexer lexer(Source::Borrow(text));
+
+            ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Id{ "x"s }));
+            lexer.ExpectNext<token_type::Char>('=');
+            ASSERT(PointsInto(lexer.ExpectNext<token_type::String>().value, text));
+            lexer.ExpectNext<token_type::Newline>();
+
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{ "y"s }));
+            lexer.ExpectNext<token_type::Char>('=');
+            const auto& escaped = lexer.ExpectNext<token_type::String>().value;
+            ASSERT_EQUAL(escaped, "esc'aped"sv);
+            ASSERT(!PointsInto(escaped, text));
+        }
+
+        void TestMappedSource() {
+            const string path = "mython_lexer_test.my"s;
+            {
+                ofstream file(path);
+                file << "class A:\n  def f():\n    return 'x'\n"s;
+            }
+            {
+                Lexer lexer(Source::Map(path));
+                ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Class{}));
+                ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{ "A"s }));
+            }
+            std::remove(path.c_str());
+
+            ASSERT_THROWS({ [[maybe_unused]] auto source = Source::Map(path); }, LexerError);
+        }
+
+        void TestSourceOutlivesInput() {
+            string text = "value = 'text'\n"s;
+            auto source = Source::Read(*make_unique<istringstream>(text));
+            text.assign(text.size(), '#');
+
+            Lexer lexer(std::move(source));
+            ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Id{ "value"s }));
+            lexer.ExpectNext<token_type::Char>('=');
+            lexer.ExpectNext<token_type::String>("text"sv);
+        }
+
+        void TestUnexpectedCharacter() {
+            ASSERT_THROWS(Lexer(Source::Borrow("x = 1\t\n"sv)), LexerError);
+            ASSERT_THROWS(Lexer(Source::Borrow("x = 'open\n'"sv)), LexerError);
+        }
+
+        vector<string> Dump(Lexer& lexer) {
+            vector<string> result;
+            for (;;) {
+                ostringstream os;
+                os << lexer.CurrentToken();
+                result.push_back(os.str());
+                if (lexer.CurrentToken().Is<token_type::Eof>()) {
+                    return result;
+                }
+                lexer.NextToken();
+            }
+        }
+
+        void TestStreamingMatchesEager() {
+            const string program = R"(
+class Counter:  # comment
+  def __init__():
+    self.value = 'a\'b' + "c"
+
+   # odd comment indent
+
+  def add(x):
+    if x >= 0 and not x != 1:
+      self.value = self.value + x
+      return None
+x = Counter()
+x.add(1))"s;
+            istringstream eager_input(program);
+            Lexer eager(eager_input);
+            const auto expected = Dump(eager);
+
+            istringstream stream_input(program);
+            Lexer streaming(stream_input, LexerMode::Streaming);
+            ASSERT_EQUAL(Dump(streaming), expected);
+
+            Lexer borrowed(Source::Borrow(program), LexerMode::Streaming);
+            ASSERT_EQUAL(Dump(borrowed), expected);
+
+            istringstream empty_input;
+            Lexer empty(empty_input, LexerMode::Streaming);
+            ASSERT_EQUAL(empty.CurrentToken(), Token(token_type::Eof{}));
+            ASSERT_EQUAL(empty.NextToken(), Token(token_type::Eof{}));
+        }
+
+        void TestStreamingIsLazy() {
+            istringstream input("x = 1\ny = 2\nz = 3\n"s);
+            Lexer lexer(input, LexerMode::Streaming);
+            ASSERT_EQUAL(input.tellg(), 6);
+
+            ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Id{ "x"s }));
+            lexer.ExpectNext<token_type::Char>('=');
+            lexer.ExpectNext<token_type::Number>(1);
+            lexer.ExpectNext<token_type::Newline>();
+            ASSERT_EQUAL(input.tellg(), 6);
+
+            lexer.ExpectNext<token_type::Id>("y"sv);
+            ASSERT_EQUAL(input.tellg(), 12);
+        }
+
+        void TestKeywordTable() {
+            const vector<pair<string, string>> keywords = {
+                { "class"s, "Class"s }, { "return"s, "Return"s }, { "if"s, "If"s }, { "else"s, "Else"s },
+                { "def"s, "Def"s }, { "print"s, "Print"s }, { "ident"s, "Indent"s }, { "dedent"s, "Dedent"s },
+                { "and"s, "And"s }, { "or"s, "Or"s }, { "not"s, "Not"s }, { "None"s, "None"s },
+                { "True"s, "True"s }, { "False"s, "False"s }, { "a == b"s, "Eq"s }, { "a != b"s, "NotEq"s },
+                { "a <= b"s, "LessOrEq"s }, { "a >= b"s, "GreaterOrEq"s },
+            };
+            for (const auto& [text, type_name] : keywords) {
+                Lexer lexer(Source::Borrow(text));
+                if (lexer.CurrentToken().Is<token_type::Id>() && text.size() > 1 && text[1] == ' ') {
+                    lexer.NextToken();
+                }
+                ostringstream os;
+                os << lexer.CurrentToken();
+                ASSERT_EQUAL(os.str(), type_name);
+            }
+
+            for (const auto* id : { "clas", "classes", "iff", "elsE", "dEf", "prin", "Nona", "TruE", "eoff", "o", "n", "an" }) {
+                Lexer lexer(Source::Borrow(id));
+                ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Id{ id }));
+            }
+
+            ostringstream os;
+            os << Token(token_type::Newline{}) << Token(token_type::Eof{}) << Token(token_type::Id{ "x"sv });
+            ASSERT_EQUAL(os.str(), "NewlineEofId{x}"s);
+        }
+
+        void TestInternedIds() {
+            runtime::Symbol first;
+            {
+                Lexer lexer(Source::Borrow("counter = other\n"sv));
+                first = lexer.CurrentToken().As<token_type::Id>().value;
+                ASSERT(lexer.ExpectNext<token_type::Char>().value == '=');
+                ASSERT(lexer.ExpectNext<token_type::Id>().value != first);
+            }
+            ASSERT_EQUAL(first.GetName(), "counter"s);
+
+            const size_t count = runtime::Symbol::Count();
+            istringstream input("counter.counter = 1\n"s);
+            Lexer lexer(input, LexerMode::Streaming);
+            ASSERT(lexer.CurrentToken().As<token_type::Id>().value.GetId() == first.GetId());
+            lexer.ExpectNext<token_type::Char>('.');
+            ASSERT(lexer.ExpectNext<token_type::Id>().value == first);
+            ASSERT_EQUAL(runtime::Symbol::Count(), count);
+        }
+
+        void TestTokenStore() {
+            const vector<Token> tokens = {
+                token_type::Number{ -7 }, token_type::Number{ 2147483647 }, token_type::Char{ '\xff' },
+                token_type::Id{ "x"s }, token_type::String{ "text"sv }, token_type::Indent{}, token_type::Id{ "y"s },
+                token_type::String{ ""sv }, token_type::Char{ '(' }, token_type::GreaterOrEq{}, token_type::Eof{},
+            };
+            TokenStore store;
+            for (const auto& token : tokens) {
+                store.Push(token);
+            }
+            ASSERT_EQUAL(store.Size(), tokens.size());
+            for (size_t ptr = 0; ptr < tokens.size(); ptr++) {
+                ASSERT_EQUAL(store.Get(ptr), tokens[ptr]);
+            }
+            store.Clear();
+            ASSERT(store.Empty());
+        }
+
+        vector<Token> ReadAll(Lexer& lexer) {
+            vector<Token> result{ lexer.CurrentToken() };
+            while (!result.back().Is<token_type::Eof>()) {
+                result.push_back(lexer.NextToken());
+            }
+            return result;
+        }
+
+        void TestParallelMatchesEager() {
+            // Inputs of lexer_test_open.cpp and indentation cases for the chunk seams
+            const string programs[] = {
+                "x = 42\n"s,
+                "class return if else def print or None and not True False"s,
+                "x    _42 big_number   Return Class  dEf"s,
+                R"('word' "two words" 'long string with a double quote " inside' "another long string with single quote ' inside")"s,
+                R"(" \'abcd\' ")"s,
+                "+-*/= > < != == <> <= >="s,
+                "\nno_indent\n  indent_one\n    indent_two\n      indent_three\n      indent_three\n"
+                "      indent_three\n    indent_two\n  indent_one\n    indent_two\nno_indent\n"s,
+                "\nx = 1\n  y = 2\n\n  z = 3\n\n\n"s,
+                "\nx = 4\ny = \"hello\"\n\nclass Point:\n  def __init__(self, x, y):\n    self.x = x\n"
+                "    self.y = y\n\n  def __str__(self):\n    return str(x) + ' ' + str(y)\n\np = Point(1, 2)\nprint str(p)\n"s,
+                "# comment\n# comment\n   \n"s,
+                "a\n   b\n    c\n  # comment\n\n      d\n e\nf 'x\\ty'\n"s,
+                "if x:\n  if y:\n    z = 'a\\'b'\n\n# gap\n\n    w = 1\nv = 2"s,
+                ""s,
+            };
+            for (const auto& program : programs) {
+                Lexer eager(Source::Borrow(program));
+                const auto expected = ReadAll(eager);
+                for (size_t chunk_size : { 0, 1, 2, 3, 5, 8, 13, 64, 1 << 20 }) {
+                    Lexer parallel(Source::Borrow(program), LexerMode::Parallel, chunk_size);
+                    ASSERT_EQUAL(ReadAll(parallel), expected);
+                }
+            }
+
+            const string broken = "x = 1\ny = 'open\nz = 2\n"s;
+            ASSERT_THROWS(Lexer(Source::Borrow(broken)), LexerError);
+            ASSERT_THROWS(Lexer(Source::Borrow(broken), LexerMode::Parallel, 1), LexerError);
+        }
+
+    }  // namespace
+
+    void RunLexerTests(TestRunner& tr) {
+        RUN_TEST(tr, parse::TestBorrowedSource);
+        RUN_TEST(tr, parse::TestMappedSource);
+        RUN_TEST(tr, parse::TestSourceOutlivesInput);
+        RUN_TEST(tr, parse::TestUnexpectedCharacter);
+        RUN_TEST(tr, parse::TestStreamingMatchesEager);
+        RUN_TEST(tr, parse::TestStreamingIsLazy);
+        RUN_TEST(tr, parse::TestKeywordTable);
+        RUN_TEST(tr, parse::TestInternedIds);
+        RUN_TEST(tr, parse::TestTokenStore);
+        RUN_TEST(tr, parse::TestParallelMatchesEager);
+    }
+
+}  // namespace parse
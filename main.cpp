@@ -1,20 +1,37 @@
+#include "cache.h"
+#include "gc.h"
 #include "lexer.h"
 #include "parse.h"
 #include "runtime.h"
 #include "statement.h"
 #include "test_runner_p.h"
+#include "vm.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
 
 using namespace std;
 
 namespace parse {
     void RunOpenLexerTests(TestRunner& tr);
+    void RunLexerTests(TestRunner& tr);
 }  // namespace parse
 
 namespace ast {
     void RunUnitTests(TestRunner& tr);
 }
+namespace bytecode {
+    void RunVmTests(TestRunner& tr);
+}  // namespace bytecode
+namespace benchmark {
+    void RunBenchmarks(ostream& out);
+}  // namespace benchmark
 namespace runtime {
     void RunObjectHolderTests(TestRunner& tr);
     void RunObjectsTests(TestRunner& tr);
@@ -24,13 +41,71 @@ void TestParseProgram(TestRunner& tr);
 
 namespace {
 
-    void RunMythonProgram(istream& input, ostream& output) {
-        parse::Lexer lexer(input);
+    enum class Engine {
+        TreeWalker,
+        Bytecode,
+    };
+
+    struct RunOptions {
+        Engine engine = Engine::TreeWalker;
+        runtime::CollectorMode collector_mode = runtime::CollectorMode::Full;
+        // The counters of the method call caches go to std::cerr after the run
+        bool print_call_sites = false;
+        // The metrics of the cycle collector go to std::cerr after the run
+        bool print_gc_stats = false;
+    };
+
+    void PrintStats(const runtime::CycleCollector& collector, const RunOptions& options, std::chrono::steady_clock::duration elapsed) {
+        if (options.print_call_sites) {
+            runtime::CallSiteCache::DumpStats(std::cerr);
+        }
+        if (options.print_gc_stats) {
+            collector.DumpStats(std::cerr);
+            const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+            std::cerr << "run: " << ms << " ms, " << collector.GetStats().allocated * 1000 / std::max<int64_t>(ms, 1) << " instances/s";
+#if defined(__unix__) || defined(__APPLE__)
+            rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+            std::cerr << ", max RSS " << usage.ru_maxrss << " KB";
+#endif
+            std::cerr << "\n";
+        }
+    }
+
+    // Runs with a cycle collector of its own. It is created after the classes its instances refer to,
+    // so it is destroyed before them
+    template <typename Run>
+    void RunCollected(const RunOptions& options, Run run) {
+        runtime::CycleCollector collector(options.collector_mode);
+        runtime::CycleCollector::Scope scope(collector);
+        const auto start = std::chrono::steady_clock::now();
+        {
+            runtime::Closure closure;
+            run(closure);
+        }
+        PrintStats(collector, options, std::chrono::steady_clock::now() - start);
+    }
+
+    void RunMythonProgram(parse::Lexer& lexer, ostream& output, const RunOptions& options = {}) {
         auto program = ParseProgram(lexer);
 
         runtime::SimpleContext context{ output };
-        runtime::Closure closure;
-        program->Execute(closure, context);
+        if (options.engine == Engine::Bytecode) {
+            auto compiled = bytecode::Compile(*program);
+            bytecode::VirtualMachine vm(*compiled);
+            RunCollected(options, [&](runtime::Closure& closure) {
+                vm.Run(closure, context);
+            });
+            return;
+        }
+        RunCollected(options, [&](runtime::Closure& closure) {
+            program->Execute(closure, context);
+        });
+    }
+
+    void RunMythonProgram(istream& input, ostream& output) {
+        parse::Lexer lexer(input);
+        RunMythonProgram(lexer, output);
     }
 
     void TestSimplePrints() {
@@ -114,10 +189,12 @@ print y.value
     void TestAll() {
         TestRunner tr;
         parse::RunOpenLexerTests(tr);
+        parse::RunLexerTests(tr);
         runtime::RunObjectHolderTests(tr);
         runtime::RunObjectsTests(tr);
         ast::RunUnitTests(tr);
         TestParseProgram(tr);
+        bytecode::RunVmTests(tr);
 
         RUN_TEST(tr, TestSimplePrints);
         RUN_TEST(tr, TestAssignments);
@@ -127,9 +204,48 @@ print y.value
 
 }  // namespace
 
-int main() {
+// Without arguments runs the tests, "mython --bench" runs the benchmarks,
+// otherwise runs a Mython file: mython [--vm] [--gc=full|generational] [--call-stats] [--gc-stats] <file>.
+// With --vm the compiled program is cached next to the file, see bytecode::LoadOrCompile
+int main(int argc, char* argv[]) {
     try {
-        TestAll();
+        if (argc == 1) {
+            TestAll();
+            return 0;
+        }
+        if (argv[1] == "--bench"sv) {
+            benchmark::RunBenchmarks(std::cout);
+            return 0;
+        }
+        RunOptions options;
+        string path;
+        for (int ptr = 1; ptr < argc; ptr++) {
+            if (argv[ptr] == "--vm"sv) {
+                options.engine = Engine::Bytecode;
+            } else if (argv[ptr] == "--call-stats"sv) {
+                options.print_call_sites = true;
+            } else if (argv[ptr] == "--gc-stats"sv) {
+                options.print_gc_stats = true;
+            } else if (argv[ptr] == "--gc=full"sv) {
+                options.collector_mode = runtime::CollectorMode::Full;
+            } else if (argv[ptr] == "--gc=generational"sv) {
+                options.collector_mode = runtime::CollectorMode::Generational;
+            } else {
+                path = argv[ptr];
+            }
+        }
+        if (options.engine == Engine::Bytecode) {
+            // The compiled program is reused from the .myc next to the file while the file is unchanged
+            auto cached = bytecode::LoadOrCompile(path, parse::LexerMode::Streaming);
+            runtime::SimpleContext context{ std::cout };
+            bytecode::VirtualMachine vm(*cached.program);
+            RunCollected(options, [&](runtime::Closure& closure) {
+                vm.Run(closure, context);
+            });
+            return 0;
+        }
+        parse::Lexer lexer(parse::Source::Map(path), parse::LexerMode::Streaming);
+        RunMythonProgram(lexer, std::cout, options);
     }
     catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
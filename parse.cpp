@@ -1,12 +1,26 @@
 #include "parse.h"
+#include "bytecode.h"
+#include "flat.h"
 #include "lexer.h"
 #include "statement.h"
 
+#include <cctype>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+
 using namespace std;
 
 namespace TokenType = parse::token_type;
 
+using runtime::Symbol;
+
 namespace {
+    const Symbol SELF = "self";
+    const Symbol STR_FUNCTION = "str";
+
     bool operator==(const parse::Token& token, char parsed_char_) {
         const auto* ptr_tkn = token.TryAs<TokenType::Char>();
         return ptr_tkn != nullptr && ptr_tkn->value == parsed_char_;
@@ -16,10 +30,84 @@ namespace {
         return !(token == parsed_char_);
     }
 
+    using ComparatorFn = bool (*)(const runtime::ObjectHolder&, const runtime::ObjectHolder&, runtime::Context&);
+
+    // Every comparator of the runtime is the negation of another one
+    const pair<ComparatorFn, ComparatorFn> INVERSE_COMPARATORS[] = {
+        { runtime::Equal, runtime::NotEqual },
+        { runtime::NotEqual, runtime::Equal },
+        { runtime::Less, runtime::GreaterOrEqual },
+        { runtime::GreaterOrEqual, runtime::Less },
+        { runtime::Greater, runtime::LessOrEqual },
+        { runtime::LessOrEqual, runtime::Greater },
+    };
+
+    bool IsConstant(const ast::Statement& node) {
+        return dynamic_cast<const ast::NumericConst*>(&node) != nullptr || dynamic_cast<const ast::StringConst*>(&node) != nullptr
+            || dynamic_cast<const ast::BoolConst*>(&node) != nullptr || dynamic_cast<const ast::None*>(&node) != nullptr;
+    }
+
+    // Nodes whose value is always a Bool
+    bool IsBool(const ast::Statement& node) {
+        return dynamic_cast<const ast::BoolConst*>(&node) != nullptr || dynamic_cast<const ast::Comparison*>(&node) != nullptr
+            || dynamic_cast<const ast::Not*>(&node) != nullptr || dynamic_cast<const ast::And*>(&node) != nullptr
+            || dynamic_cast<const ast::Or*>(&node) != nullptr;
+    }
+
+    // True when the integer operation has no int result: it overflows, or it is INT_MIN / -1,
+    // which traps. Such an operation is not folded and only fails if it ever runs
+    template <typename Operation>
+    bool OutOfRange(const ast::Statement& lhs, const ast::Statement& rhs) {
+        const auto* lhs_num = dynamic_cast<const ast::NumericConst*>(&lhs);
+        const auto* rhs_num = dynamic_cast<const ast::NumericConst*>(&rhs);
+        if (lhs_num == nullptr || rhs_num == nullptr) {
+            return false;
+        }
+        const int64_t a = lhs_num->GetValue().GetValue();
+        const int64_t b = rhs_num->GetValue().GetValue();
+        int64_t result = 0;
+        if constexpr (std::is_same_v<Operation, ast::Add>) {
+            result = a + b;
+        } else if constexpr (std::is_same_v<Operation, ast::Sub>) {
+            result = a - b;
+        } else if constexpr (std::is_same_v<Operation, ast::Mult>) {
+            result = a * b;
+        } else {
+            result = b == 0 ? 0 : a / b;
+        }
+        return result < std::numeric_limits<int>::min() || result > std::numeric_limits<int>::max();
+    }
+
+    // Replaces an operation over constants with its value
+    unique_ptr<ast::Statement> Fold(unique_ptr<ast::Statement> node) {
+        runtime::Closure closure;
+        runtime::DummyContext context;
+        runtime::ObjectHolder value;
+        try {
+            value = node->Execute(closure, context);
+        } catch (const std::runtime_error&) {
+            return node;
+        }
+        if (!value) {
+            return make_unique<ast::None>();
+        }
+        if (const auto* number = value.TryAs<runtime::Number>()) {
+            return make_unique<ast::NumericConst>(*number);
+        }
+        if (const auto* str = value.TryAs<runtime::String>()) {
+            return make_unique<ast::StringConst>(*str);
+        }
+        if (const auto* boolean = value.TryAs<runtime::Bool>()) {
+            return make_unique<ast::BoolConst>(*boolean);
+        }
+        return node;
+    }
+
     class Parser {
     public:
-        explicit Parser(parse::Lexer& lexer)
-            : lexer_(lexer) {
+        // Classes declared by the program are added to declared_classes
+        Parser(parse::Lexer& lexer, runtime::Closure& declared_classes)
+            : lexer_(lexer), declared_classes_(declared_classes) {
         }
         unique_ptr<ast::Statement> ParseProgram() {
             auto result = make_unique<ast::Compound>();
@@ -30,6 +118,10 @@ namespace {
             return result;
         }
 
+        [[nodiscard]] const vector<Symbol>& GetDeclaredClasses() const {
+            return declared_;
+        }
+
     private:
         unique_ptr<ast::Statement> ParseSuite() {
             lexer_.Expect<TokenType::Newline>();
@@ -58,34 +150,38 @@ namespace {
                 lexer_.ExpectNext<TokenType::Char>('(');
 
                 if (lexer_.NextToken().Is<TokenType::Id>()) {
-                    m.formal_params.push_back(lexer_.Expect<TokenType::Id>().value);
+                    m.formal_params.emplace_back(lexer_.Expect<TokenType::Id>().value);
                     while (lexer_.NextToken() == ',') {
-                        m.formal_params.push_back(lexer_.ExpectNext<TokenType::Id>().value);
+                        m.formal_params.emplace_back(lexer_.ExpectNext<TokenType::Id>().value);
                     }
                 }
                 lexer_.Expect<TokenType::Char>(')');
                 lexer_.ExpectNext<TokenType::Char>(':');
                 lexer_.NextToken();
+
+                OpenScope(m.formal_params);
                 m.body = std::make_unique<ast::MethodBody>(ParseSuite());
+                m.frame_size = scopes_.back().size;
+                scopes_.pop_back();
                 result.push_back(std::move(m));
             }
             return result;
         }
 
         unique_ptr<ast::Statement> ParseClassDefinition() {
-            string class_name = lexer_.Expect<TokenType::Id>().value;
+            const string& class_name = lexer_.Expect<TokenType::Id>().value.GetName();
 
             lexer_.NextToken();
 
             const runtime::Class* base_class = nullptr;
             if (lexer_.CurrentToken() == '(') {
-                auto name = lexer_.ExpectNext<TokenType::Id>().value;
+                Symbol name = lexer_.ExpectNext<TokenType::Id>().value;
                 lexer_.ExpectNext<TokenType::Char>(')');
                 lexer_.NextToken();
 
                 auto it = declared_classes_.find(name);
                 if (it == declared_classes_.end()) {
-                    throw ParseError("Base class "s + name + " not found for class "s + class_name);
+                    throw ParseError("Base class "s + name.GetName() + " not found for class "s + class_name);
                 }
                 base_class = static_cast<const runtime::Class*>(it->second.Get());
             }
@@ -107,12 +203,13 @@ namespace {
             if (!inserted) {
                 throw ParseError("Class "s + class_name + " already exists"s);
             }
+            declared_.push_back(it->first);
 
             return make_unique<ast::ClassDefinition>(it->second);
         }
 
-        vector<string> ParseDottedIds() {
-            vector<string> result(1, lexer_.Expect<TokenType::Id>().value);
+        vector<Symbol> ParseDottedIds() {
+            vector<Symbol> result(1, lexer_.Expect<TokenType::Id>().value);
 
             while (lexer_.NextToken() == '.') {
                 result.push_back(lexer_.ExpectNext<TokenType::Id>().value);
@@ -124,24 +221,26 @@ namespace {
         unique_ptr<ast::Statement> ParseAssignmentOrCall() {
             lexer_.Expect<TokenType::Id>();
 
-            vector<string> id_list = ParseDottedIds();
-            string last_name = id_list.back();
+            vector<Symbol> id_list = ParseDottedIds();
+            Symbol last_name = id_list.back();
             id_list.pop_back();
 
             if (lexer_.CurrentToken() == '=') {
                 lexer_.NextToken();
 
                 if (id_list.empty()) {
-                    return make_unique<ast::Assignment>(std::move(last_name), ParseTest());
+                    auto rv = ParseTest();
+                    auto slot = DeclareLocal(last_name);
+                    return make_unique<ast::Assignment>(last_name, std::move(rv), slot);
                 }
-                return make_unique<ast::FieldAssignment>(ast::VariableValue{ std::move(id_list) },
-                    std::move(last_name), ParseTest());
+                return make_unique<ast::FieldAssignment>(MakeVariable(std::move(id_list)),
+                    last_name, ParseTest());
             }
             lexer_.Expect<TokenType::Char>('(');
             lexer_.NextToken();
 
             if (id_list.empty()) {
-                throw ParseError("Mython doesn't support functions, only methods: "s + last_name);
+                throw ParseError("Mython doesn't support functions, only methods: "s + last_name.GetName());
             }
 
             vector<unique_ptr<ast::Statement>> args;
@@ -151,8 +250,8 @@ namespace {
             lexer_.Expect<TokenType::Char>(')');
             lexer_.NextToken();
 
-            return make_unique<ast::MethodCall>(make_unique<ast::VariableValue>(std::move(id_list)),
-                std::move(last_name), std::move(args));
+            return make_unique<ast::MethodCall>(make_unique<ast::VariableValue>(MakeVariable(std::move(id_list))),
+                last_name, std::move(args));
         }
 
         unique_ptr<ast::Statement> ParseExpression() {
@@ -162,9 +261,9 @@ namespace {
                 lexer_.NextToken();
 
                 if (op == '+') {
-                    result = make_unique<ast::Add>(std::move(result), ParseAdder());
+                    result = MakeBinary<ast::Add>(std::move(result), ParseAdder());
                 } else {
-                    result = make_unique<ast::Sub>(std::move(result), ParseAdder());
+                    result = MakeBinary<ast::Sub>(std::move(result), ParseAdder());
                 }
             }
             return result;
@@ -177,9 +276,9 @@ namespace {
                 lexer_.NextToken();
 
                 if (op == '*') {
-                    result = make_unique<ast::Mult>(std::move(result), ParseMult());
+                    result = MakeBinary<ast::Mult>(std::move(result), ParseMult());
                 } else {
-                    result = make_unique<ast::Div>(std::move(result), ParseMult());
+                    result = MakeBinary<ast::Div>(std::move(result), ParseMult());
                 }
             }
             return result;
@@ -188,14 +287,14 @@ namespace {
         unique_ptr<ast::Statement> ParseMult() {
             if (lexer_.CurrentToken() == '(') {
                 lexer_.NextToken();
-                auto result = ParseTest();
+                auto result = ParseOrTest();
                 lexer_.Expect<TokenType::Char>(')');
                 lexer_.NextToken();
                 return result;
             }
             if (lexer_.CurrentToken() == '-') {
                 lexer_.NextToken();
-                return make_unique<ast::Mult>(ParseMult(), make_unique<ast::NumericConst>(-1));
+                return MakeBinary<ast::Mult>(ParseMult(), make_unique<ast::NumericConst>(-1));
             }
             if (const auto* num = lexer_.CurrentToken().TryAs<TokenType::Number>()) {
                 int result = num->value;
@@ -203,7 +302,7 @@ namespace {
                 return make_unique<ast::NumericConst>(result);
             }
             if (const auto* str = lexer_.CurrentToken().TryAs<TokenType::String>()) {
-                string result = str->value;
+                string result(str->value);
                 lexer_.NextToken();
                 return make_unique<ast::StringConst>(std::move(result));
             }
@@ -224,7 +323,7 @@ namespace {
         }
 
         std::unique_ptr<ast::Statement> ParseDottedIdsInMultExpr() {
-            vector<string> names = ParseDottedIds();
+            vector<Symbol> names = ParseDottedIds();
 
             if (lexer_.CurrentToken() == '(') {
                 vector<unique_ptr<ast::Statement>> args;
@@ -239,22 +338,22 @@ namespace {
 
                 if (!names.empty()) {
                     return make_unique<ast::MethodCall>(
-                        make_unique<ast::VariableValue>(std::move(names)), std::move(method_name),
+                        make_unique<ast::VariableValue>(MakeVariable(std::move(names))), method_name,
                         std::move(args));
                 }
                 if (auto it = declared_classes_.find(method_name); it != declared_classes_.end()) {
                     return make_unique<ast::NewInstance>(
                         static_cast<const runtime::Class&>(*it->second), std::move(args));
                 }
-                if (method_name == "str"sv) {
+                if (method_name == STR_FUNCTION) {
                     if (args.size() != 1) {
                         throw ParseError("Function str takes exactly one argument"s);
                     }
                     return make_unique<ast::Stringify>(std::move(args.front()));
                 }
-                throw ParseError("Unknown call to "s + method_name + "()"s);
+                throw ParseError("Unknown call to "s + method_name.GetName() + "()"s);
             }
-            return make_unique<ast::VariableValue>(std::move(names));
+            return make_unique<ast::VariableValue>(MakeVariable(std::move(names)));
         }
 
         vector<unique_ptr<ast::Statement>> ParseTestList() {
@@ -289,11 +388,21 @@ namespace {
             return make_unique<ast::IfElse>(std::move(condition), std::move(if_body), std::move(else_body));
         }
 
+        // A whole expression. Method bodies are what runs more than once, so there expressions
+        // large enough to gain from it are stored flat
         unique_ptr<ast::Statement> ParseTest() {
+            auto result = ParseOrTest();
+            if (scopes_.empty()) {
+                return result;
+            }
+            return ast::FlatExpression::Flatten(std::move(result));
+        }
+
+        unique_ptr<ast::Statement> ParseOrTest() {
             auto result = ParseAndTest();
             while (lexer_.CurrentToken().Is<TokenType::Or>()) {
                 lexer_.NextToken();
-                result = make_unique<ast::Or>(std::move(result), ParseAndTest());
+                result = MakeBinary<ast::Or>(std::move(result), ParseAndTest());
             }
             return result;
         }
@@ -302,7 +411,7 @@ namespace {
             auto result = ParseNotTest();
             while (lexer_.CurrentToken().Is<TokenType::And>()) {
                 lexer_.NextToken();
-                result = make_unique<ast::And>(std::move(result), ParseNotTest());
+                result = MakeBinary<ast::And>(std::move(result), ParseNotTest());
             }
             return result;
         }
@@ -310,7 +419,7 @@ namespace {
         unique_ptr<ast::Statement> ParseNotTest() {
             if (lexer_.CurrentToken().Is<TokenType::Not>()) {
                 lexer_.NextToken();
-                return make_unique<ast::Not>(ParseNotTest());
+                return MakeNot(ParseNotTest());
             }
             return ParseComparison();
         }
@@ -321,37 +430,66 @@ namespace {
 
             if (tok == '<') {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::Less, std::move(result),
-                    ParseExpression());
+                return MakeComparison(runtime::Less, std::move(result), ParseExpression());
             }
             if (tok == '>') {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::Greater, std::move(result),
-                    ParseExpression());
+                return MakeComparison(runtime::Greater, std::move(result), ParseExpression());
             }
             if (tok.Is<TokenType::Eq>()) {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::Equal, std::move(result),
-                    ParseExpression());
+                return MakeComparison(runtime::Equal, std::move(result), ParseExpression());
             }
             if (tok.Is<TokenType::NotEq>()) {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::NotEqual, std::move(result),
-                    ParseExpression());
+                return MakeComparison(runtime::NotEqual, std::move(result), ParseExpression());
             }
             if (tok.Is<TokenType::LessOrEq>()) {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::LessOrEqual, std::move(result),
-                    ParseExpression());
+                return MakeComparison(runtime::LessOrEqual, std::move(result), ParseExpression());
             }
             if (tok.Is<TokenType::GreaterOrEq>()) {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::GreaterOrEqual, std::move(result),
-                    ParseExpression());
+                return MakeComparison(runtime::GreaterOrEqual, std::move(result), ParseExpression());
             }
             return result;
         }
 
+        // An operation over constants is evaluated right away. One that fails, like a division
+        // by zero, or has no int result is kept for run time
+        template <typename Operation>
+        static unique_ptr<ast::Statement> MakeBinary(unique_ptr<ast::Statement> lhs, unique_ptr<ast::Statement> rhs) {
+            const bool constant = IsConstant(*lhs) && IsConstant(*rhs) && !OutOfRange<Operation>(*lhs, *rhs);
+            unique_ptr<ast::Statement> result = make_unique<Operation>(std::move(lhs), std::move(rhs));
+            return constant ? Fold(std::move(result)) : std::move(result);
+        }
+
+        static unique_ptr<ast::Statement> MakeComparison(ComparatorFn cmp, unique_ptr<ast::Statement> lhs, unique_ptr<ast::Statement> rhs) {
+            const bool constant = IsConstant(*lhs) && IsConstant(*rhs);
+            unique_ptr<ast::Statement> result = make_unique<ast::Comparison>(cmp, std::move(lhs), std::move(rhs));
+            return constant ? Fold(std::move(result)) : std::move(result);
+        }
+
+        // not (a < b) is a >= b, and not not x is x when x is a Bool already
+        static unique_ptr<ast::Statement> MakeNot(unique_ptr<ast::Statement> arg) {
+            if (IsConstant(*arg)) {
+                return Fold(make_unique<ast::Not>(std::move(arg)));
+            }
+            if (auto* comparison = dynamic_cast<ast::Comparison*>(arg.get())) {
+                if (const auto* cmp = comparison->GetComparator().target<ComparatorFn>()) {
+                    for (const auto& [comparator, inverse] : INVERSE_COMPARATORS) {
+                        if (*cmp == comparator) {
+                            return make_unique<ast::Comparison>(inverse, std::move(comparison->lhs_), std::move(comparison->rhs_));
+                        }
+                    }
+                }
+            }
+            if (auto* inner = dynamic_cast<ast::Not*>(arg.get()); inner != nullptr && IsBool(*inner->arg_)) {
+                return std::move(inner->arg_);
+            }
+            return make_unique<ast::Not>(std::move(arg));
+        }
+
         unique_ptr<ast::Statement> ParseStatement() {
             const auto& tok = lexer_.CurrentToken();
 
@@ -372,6 +510,10 @@ namespace {
             const auto& tok = lexer_.CurrentToken();
 
             if (tok.Is<TokenType::Return>()) {
+                // Only a MethodBody takes the value, outside of one the signal would stop the program
+                if (scopes_.empty()) {
+                    throw ParseError("return outside of a method"s);
+                }
                 lexer_.NextToken();
                 return make_unique<ast::Return>(ParseTest());
             }
@@ -386,12 +528,271 @@ namespace {
             return ParseAssignmentOrCall();
         }
 
+        // Locals of a method get frame slots in the order runtime::ClassInstance::Call fills them:
+        // parameters, self, then everything assigned in the body
+        void OpenScope(const vector<Symbol>& formal_params) {
+            MethodScope scope;
+            for (const auto& param : formal_params) {
+                scope.slots.insert({ param, scope.size++ });
+            }
+            scope.slots.insert({ SELF, scope.size++ });
+            scopes_.push_back(std::move(scope));
+        }
+
+        optional<size_t> FindLocal(Symbol name) const {
+            if (scopes_.empty()) {
+                return nullopt;
+            }
+            const auto& slots = scopes_.back().slots;
+            if (auto it = slots.find(name); it != slots.end()) {
+                return it->second;
+            }
+            return nullopt;
+        }
+
+        optional<size_t> DeclareLocal(Symbol name) {
+            if (scopes_.empty()) {
+                return nullopt;
+            }
+            auto& scope = scopes_.back();
+            auto [it, inserted] = scope.slots.insert({ name, scope.size });
+            if (inserted) {
+                ++scope.size;
+            }
+            return it->second;
+        }
+
+        ast::VariableValue MakeVariable(const vector<Symbol>& names) const {
+            auto slot = FindLocal(names.front());
+            return ast::VariableValue(names, slot);
+        }
+
+        struct MethodScope {
+            unordered_map<Symbol, size_t> slots;
+            size_t size = 0;
+        };
+
         parse::Lexer& lexer_;
-        runtime::Closure declared_classes_;
+        runtime::Closure& declared_classes_;
+        vector<Symbol> declared_;
+        // Top-level code has no scope and keeps its variables in the Closure
+        vector<MethodScope> scopes_;
     };
 
 }  // namespace
 
 unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer) {
-    return Parser{ lexer }.ParseProgram();
-}
\ No newline at end of file
+    auto arena = make_shared<runtime::Arena>();
+    runtime::Closure declared_classes;
+    unique_ptr<runtime::Executable> root;
+    {
+        runtime::Arena::Scope scope(*arena);
+        root = Parser{ lexer, declared_classes }.ParseProgram();
+    }
+    return make_unique<runtime::ArenaProgram>(std::move(arena), std::move(root));
+}
+
+namespace parse {
+
+    namespace {
+        bool StartsWithWord(string_view line, string_view word) {
+            return line.substr(0, word.size()) == word && (line.size() == word.size()
+                || !(isalnum(static_cast<unsigned char>(line[word.size()])) || line[word.size()] == '_'));
+        }
+
+        // A nonblank line at column zero starts a unit, except for an else that continues an if
+        bool IsUnitStart(string_view line) {
+            return !line.empty() && line[0] != ' ' && line[0] != '#' && line[0] != '\r' && !StartsWithWord(line, "else"sv);
+        }
+
+        vector<string> SplitLines(string_view text) {
+            vector<string> result;
+            while (!text.empty()) {
+                const size_t line_end = text.find('\n');
+                result.emplace_back(text.substr(0, line_end));
+                text.remove_prefix(line_end == string_view::npos ? text.size() : line_end + 1);
+            }
+            return result;
+        }
+    }  // namespace
+
+    IncrementalProgram::IncrementalProgram(string_view text) : lines_(SplitLines(text)) {
+        this->units_ = this->Split(0, this->lines_.size());
+        if (this->units_.empty()) {
+            this->units_.emplace_back();
+        }
+        this->ParseUnits(0, this->units_.size(), false);
+    }
+
+    IncrementalProgram::~IncrementalProgram() = default;
+
+    void IncrementalProgram::Edit(size_t first_line, size_t line_count, string_view text) {
+        if (first_line > this->lines_.size() || line_count > this->lines_.size() - first_line) {
+            throw out_of_range("Edit is out of the program");
+        }
+        auto lines = SplitLines(text);
+
+        // Units [first, last] hold the edited lines, the unit after them keeps its start
+        size_t first = 0;
+        size_t first_start = 0;
+        while (first + 1 < this->units_.size() && first_start + this->units_[first].lines <= first_line) {
+            first_start += this->units_[first++].lines;
+        }
+        size_t last = first;
+        size_t end_line = first_start + this->units_[first].lines;
+        while (end_line < first_line + line_count) {
+            end_line += this->units_[++last].lines;
+        }
+
+        this->lines_.erase(this->lines_.begin() + first_line, this->lines_.begin() + first_line + line_count);
+        this->lines_.insert(this->lines_.begin() + first_line, std::make_move_iterator(lines.begin()), std::make_move_iterator(lines.end()));
+        end_line = end_line - line_count + lines.size();
+        // The line now in front of the first unit may continue the unit before it
+        if (first > 0 && first_start == first_line && first_line < end_line && !IsUnitStart(this->lines_[first_line])) {
+            first_start -= this->units_[--first].lines;
+        }
+
+        bool cascade = false;
+        for (size_t ptr = first; ptr <= last; ptr++) {
+            cascade = cascade || !this->units_[ptr].classes.empty();
+            this->Retire(this->units_[ptr]);
+        }
+        auto units = this->Split(first_start, end_line);
+        for (size_t ptr = 0, line = first_start; ptr < units.size(); line += units[ptr++].lines) {
+            cascade = cascade || StartsWithWord(this->lines_[line], "class"sv);
+        }
+        const size_t count = units.size();
+        this->units_.erase(this->units_.begin() + first, this->units_.begin() + last + 1);
+        this->units_.insert(this->units_.begin() + first, std::make_move_iterator(units.begin()), std::make_move_iterator(units.end()));
+        if (this->units_.empty()) {
+            this->units_.emplace_back();
+        }
+        this->ParseUnits(first, first + count, cascade);
+    }
+
+    string IncrementalProgram::GetText() const {
+        string result;
+        for (const auto& line : this->lines_) {
+            result += line;
+            result += '\n';
+        }
+        return result;
+    }
+
+    size_t IncrementalProgram::GetLineCount() const {
+        return this->lines_.size();
+    }
+
+    size_t IncrementalProgram::GetUnitCount() const {
+        return this->units_.size();
+    }
+
+    size_t IncrementalProgram::GetReparsedCount() const {
+        return this->reparsed_;
+    }
+
+    runtime::ObjectHolder IncrementalProgram::Execute(runtime::Closure& closure, runtime::Context& context) {
+        this->CheckParsed();
+        for (size_t ptr = 0; ptr < this->units_.size() && !context.IsReturning(); ptr++) {
+            this->units_[ptr].program->Execute(closure, context);
+        }
+        return runtime::ObjectHolder::None();
+    }
+
+    void IncrementalProgram::Compile(bytecode::Compiler& compiler) {
+        this->CheckParsed();
+        for (const auto& unit : this->units_) {
+            unit.program->Compile(compiler);
+            compiler.Emit(bytecode::OpCode::Pop);
+        }
+        compiler.Emit(bytecode::OpCode::LoadNone);
+    }
+
+    vector<IncrementalProgram::Unit> IncrementalProgram::Split(size_t first_line, size_t end_line) const {
+        vector<Unit> result;
+        for (size_t line = first_line; line < end_line; line++) {
+            if (result.empty() || IsUnitStart(this->lines_[line])) {
+                result.emplace_back();
+            }
+            ++result.back().lines;
+        }
+        return result;
+    }
+
+    void IncrementalProgram::ParseUnits(size_t first, size_t last, bool cascade) {
+        // Units after a changed class may use it, so they are parsed again as well
+        if (cascade) {
+            for (size_t ptr = last; ptr < this->units_.size(); ptr++) {
+                this->Retire(this->units_[ptr]);
+            }
+            last = this->units_.size();
+        }
+        // A unit sees the classes of the units before it only, as in a parse of the whole text.
+        // A unit holds references to the classes it uses, so it must not see a later unit's
+        // class: an edit of that unit would not parse it again
+        runtime::Closure visible;
+        auto add_visible = [this, &visible](const Unit& unit) {
+            for (auto name : unit.classes) {
+                visible[name] = this->declared_classes_.at(name);
+            }
+        };
+
+        // Units that failed to parse before are retried in order
+        size_t start = 0;
+        size_t line = 0;
+        while (start < first && this->units_[start].program) {
+            add_visible(this->units_[start]);
+            line += this->units_[start++].lines;
+        }
+
+        this->reparsed_ = 0;
+        for (size_t ptr = start; ptr < this->units_.size(); line += this->units_[ptr++].lines) {
+            auto& unit = this->units_[ptr];
+            if (unit.program && (ptr < first || ptr >= last)) {
+                add_visible(unit);
+                continue;
+            }
+            string text;
+            for (size_t index = line; index < line + unit.lines; index++) {
+                text += this->lines_[index];
+                text += '\n';
+            }
+            Lexer lexer(Source::Borrow(text));
+            Parser parser(lexer, visible);
+            unit.arena = make_shared<runtime::Arena>();
+            try {
+                runtime::Arena::Scope scope(*unit.arena);
+                unit.program = parser.ParseProgram();
+            } catch (...) {
+                // The classes declared before the error are only in visible
+                this->Retire(unit);
+                throw;
+            }
+            unit.classes = parser.GetDeclaredClasses();
+            for (auto name : unit.classes) {
+                this->declared_classes_[name] = visible.at(name);
+            }
+            ++this->reparsed_;
+        }
+    }
+
+    // Instances of the retired classes may still be around. They keep their class alive,
+    // and the class keeps the arena of the unit with its methods
+    void IncrementalProgram::Retire(Unit& unit) {
+        for (auto name : unit.classes) {
+            this->declared_classes_.erase(name);
+        }
+        unit.program.reset();
+        unit.classes.clear();
+        unit.arena.reset();
+    }
+
+    void IncrementalProgram::CheckParsed() const {
+        for (const auto& unit : this->units_) {
+            if (!unit.program) {
+                throw ParseError("Program has statements that failed to parse"s);
+            }
+        }
+    }
+
+}  // namespace parse
\ No newline at end of file
@@ -1,18 +1,74 @@
 #pragma once
 
+#include "arena.h"
+#include "runtime.h"
+
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace parse {
     class Lexer;
 }
 
-namespace runtime {
-    class Executable;
-}
-
 struct ParseError : std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
-std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer);
\ No newline at end of file
+std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer);
+
+namespace parse {
+
+    // Program source kept as top-level units: a statement starting at column zero with its
+    // indented lines and else branches. An edit relexes and reparses only the units holding
+    // the changed lines, and all the units after them when a class definition changes
+    class IncrementalProgram : public runtime::Executable {
+    public:
+        explicit IncrementalProgram(std::string_view text);
+
+        ~IncrementalProgram() override;
+
+        // Replaces line_count lines from first_line on with the lines of text. On ParseError the
+        // units that failed stay unparsed and are retried by the next edit
+        void Edit(size_t first_line, size_t line_count, std::string_view text);
+
+        [[nodiscard]] std::string GetText() const;
+
+        [[nodiscard]] size_t GetLineCount() const;
+
+        [[nodiscard]] size_t GetUnitCount() const;
+
+        // Units parsed by the last edit or the constructor
+        [[nodiscard]] size_t GetReparsedCount() const;
+
+        runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+    private:
+        struct Unit {
+            size_t lines = 0;
+            std::shared_ptr<runtime::Arena> arena;
+            // Empty until parsed
+            std::unique_ptr<runtime::Executable> program;
+            std::vector<runtime::Symbol> classes;
+        };
+
+        std::vector<Unit> Split(size_t first_line, size_t end_line) const;
+
+        // Parses the units in [first, last) and the ones left unparsed by a failed edit
+        void ParseUnits(size_t first, size_t last, bool cascade);
+
+        void Retire(Unit& unit);
+
+        void CheckParsed() const;
+
+        std::vector<std::string> lines_;
+        std::vector<Unit> units_;
+        // Classes of the parsed units by name
+        runtime::Closure declared_classes_;
+        size_t reparsed_ = 0;
+    };
+
+}  // namespace parse
\ No newline at end of file
@@ -1,8 +1,11 @@
+#include "bytecode.h"
 #include "lexer.h"
 #include "parse.h"
 #include "statement.h"
 #include "test_runner_p.h"
 
+#include <algorithm>
+
 using namespace std;
 
 namespace parse {
@@ -117,6 +120,11 @@ print x.calc(2)
         ASSERT_EQUAL(context.output.str(), "2\n"s);
     }
 
+    void TestReturnOutsideMethod() {
+        ASSERT_THROWS(ParseProgramFromString("x = 1\nreturn x\nprint x\n"s), ParseError);
+        ASSERT_THROWS(ParseProgramFromString("if True:\n  return 1\n"s), ParseError);
+    }
+
     void TestRecursion() {
         const string program = R"(
 class ArithmeticProgression:
@@ -244,6 +252,252 @@ print r, c, t1, t2
             "Rect(10x20) Circle(52) Triangle(3, 4, 5) Wrong triangle\n"s);
     }
 
+    string RunIncremental(IncrementalProgram& program) {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        program.Execute(closure, context);
+        return context.output.str();
+    }
+
+    string RunFull(const string& text) {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        ParseProgramFromString(text)->Execute(closure, context);
+        return context.output.str();
+    }
+
+    void TestIncrementalEdits() {
+        IncrementalProgram program(R"(# counters
+class Counter:
+  def __init__(start):
+    self.value = start
+
+  def next():
+    self.value = self.value + 1
+    return self.value
+
+x = 1
+if x > 0:
+  print 'positive'
+else:
+  print 'negative'
+c = Counter(x)
+print c.next(), c.next()
+)"sv);
+        ASSERT_EQUAL(program.GetUnitCount(), 6U);
+        ASSERT_EQUAL(RunIncremental(program), "positive\n2 3\n"s);
+
+        struct Edit {
+            size_t first_line;
+            size_t line_count;
+            string_view text;
+            size_t reparsed;
+        };
+        const Edit edits[] = {
+            { 9, 1, "x = -5"sv, 1 },
+            { 11, 1, "  print 'positive', x"sv, 1 },
+            { 13, 0, "  print 'still negative'\n"sv, 1 },
+            { 7, 1, "    return self.value + 10"sv, 5 },
+            { 17, 0, "print c.next()\ny = Counter(2)\n"sv, 3 },
+            { 9, 0, "\n  # comment\n"sv, 7 },
+            { 0, 1, ""sv, 0 },
+            { 14, 1, "  print 'still', 'negative'"sv, 1 },
+            { 15, 1, ""sv, 1 },
+            { 15, 0, "z = 3\n"sv, 2 },
+            { 15, 1, ""sv, 0 },
+        };
+        for (const auto& edit : edits) {
+            program.Edit(edit.first_line, edit.line_count, edit.text);
+            ASSERT_EQUAL(program.GetReparsedCount(), edit.reparsed);
+            ASSERT_EQUAL(RunIncremental(program), RunFull(program.GetText()));
+        }
+        ASSERT_EQUAL(RunIncremental(program), "still negative\n6 7\n8\n"s);
+
+        // A unit that fails stays unparsed until an edit fixes it
+        ASSERT_THROWS(program.Edit(11, 1, "if x >:"sv), std::runtime_error);
+        ASSERT_THROWS(RunIncremental(program), ParseError);
+        program.Edit(11, 1, "if x > -10:"sv);
+        ASSERT_EQUAL(program.GetReparsedCount(), 1U);
+        ASSERT_EQUAL(RunIncremental(program), "positive -5\n6 7\n8\n"s);
+
+        // Classes are looked up by the units after them, which are parsed again with the new class
+        program.Edit(0, 0, "class Base:\n  def twice():\n    return self.next() * 2\n"sv);
+        ASSERT_EQUAL(program.GetReparsedCount(), 8U);
+        program.Edit(3, 1, "class Counter(Base):"sv);
+        ASSERT_EQUAL(program.GetReparsedCount(), 7U);
+        program.Edit(program.GetLineCount(), 0, "print c.twice()\n"sv);
+        ASSERT_EQUAL(program.GetReparsedCount(), 2U);
+        ASSERT_EQUAL(RunIncremental(program), RunFull(program.GetText()));
+        ASSERT_EQUAL(RunIncremental(program), "positive -5\n6 7\n8\n18\n"s);
+    }
+
+    // Output of the run, or "error" when parsing or running fails
+    template <typename Run>
+    string OutputOrError(Run run) {
+        try {
+            return run();
+        } catch (const std::exception&) {
+            return "error"s;
+        }
+    }
+
+    void TestIncrementalMatchesFullParse() {
+        IncrementalProgram program("x = 1\nclass Later:\n  def f():\n    return 1\nprint 2\n"sv);
+        struct Edit {
+            size_t first_line;
+            size_t line_count;
+            string_view text;
+        };
+        const Edit edits[] = {
+            // Classes are not seen before their definition, so editing them later is safe
+            { 0, 1, "x = Later()"sv },
+            { 3, 1, "    return 3"sv },
+            { 0, 1, "y = 1"sv },
+            { 5, 0, "x = Later()\nprint x.f()\n"sv },
+            { 1, 1, "class Early:"sv },
+            { 1, 1, "class Later:"sv },
+            { 0, 0, "class Base:\n  def g():\n    return 7\n"sv },
+            { 4, 1, "class Later(Base):"sv },
+            { 9, 1, "print x.f(), x.g()"sv },
+            { 0, 1, "class Base(Later):"sv },
+            { 0, 1, "class Base:"sv },
+            // A second class of the same name, then the first one again
+            { 7, 1, "class Base:\n  def h():\n    return 0"sv },
+            { 7, 3, "print 2"sv },
+        };
+        string outputs;
+        for (const auto& edit : edits) {
+            try {
+                program.Edit(edit.first_line, edit.line_count, edit.text);
+            } catch (const std::exception&) {
+            }
+            const string expected = OutputOrError([&program] {
+                return RunFull(program.GetText());
+            });
+            ASSERT_EQUAL(OutputOrError([&program] {
+                return RunIncremental(program);
+            }), expected);
+            outputs += expected + "|"s;
+        }
+        ASSERT_EQUAL(outputs, "error|error|2\n|2\n3\n|error|2\n3\n|2\n3\n|2\n3\n|2\n3 7\n|error|2\n3 7\n|error|2\n3 7\n|"s);
+    }
+
+    void TestRetiredClasses() {
+        IncrementalProgram program("class A:\n  def get():\n    return 1\n\na = A()\nprint a.get()\n"sv);
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        program.Execute(closure, context);
+        auto old = closure.at("a"s);
+
+        // The instance made before the edit keeps the old class and its methods, and is the only
+        // holder of them, so they go with it
+        program.Edit(2, 1, "    return 2"sv);
+        program.Execute(closure, context);
+        auto* instance = old.TryAs<runtime::ClassInstance>();
+        ASSERT_EQUAL(instance->GetClass().GetRefCount(), 1U);
+        ASSERT_EQUAL(instance->Call("get"s, {}, context).TryAs<runtime::Number>()->GetValue(), 1);
+        ASSERT_EQUAL(context.output.str(), "1\n2\n"s);
+        old = runtime::ObjectHolder::None();
+    }
+
+    void TestProgramArena() {
+        auto tree = ParseProgramFromString(R"(
+class Pair:
+  def __init__(a, b):
+    self.a = a
+    self.b = b
+
+  def sum():
+    return self.a + self.b
+
+p = Pair(2, 3)
+print p.sum() * 2 - 1
+)"s);
+        const auto* program = dynamic_cast<const runtime::ArenaProgram*>(tree.get());
+        ASSERT(program != nullptr);
+        ASSERT_EQUAL(program->GetArena().GetBlockCount(), 1U);
+        const size_t used = program->GetArena().GetUsedBytes();
+        ASSERT(used > 0);
+
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        tree->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "9\n"s);
+
+        // Only nodes created under a scope go to the arena
+        runtime::Arena arena;
+        auto heap_node = make_unique<ast::NumericConst>(1);
+        {
+            runtime::Arena::Scope scope(arena);
+            auto arena_node = make_unique<ast::NumericConst>(2);
+            ASSERT_EQUAL(arena.GetBlockCount(), 1U);
+        }
+        const size_t arena_used = arena.GetUsedBytes();
+        auto another_heap_node = make_unique<ast::StringConst>("x"s);
+        ASSERT_EQUAL(arena.GetUsedBytes(), arena_used);
+        ASSERT_EQUAL(program->GetArena().GetUsedBytes(), used);
+    }
+
+    void TestConstantFolding() {
+        istringstream is(R"(
+x = 2
+print 2 * 3 + 4, -5, 'a' + 'b', 1 < 2 and not False, None == None
+print not not x < 3, not x == 2, not not x
+)"s);
+        parse::Lexer lexer(is);
+        auto tree = ParseProgram(lexer);
+        auto compiled = bytecode::Compile(*tree);
+
+        const auto& constants = compiled->constants;
+        for (const bytecode::Constant& folded : { bytecode::Constant(10), bytecode::Constant(-5), bytecode::Constant("ab"s) }) {
+            ASSERT(std::find(constants.begin(), constants.end(), folded) != constants.end());
+        }
+        size_t negations = 0;
+        for (const auto& ins : compiled->chunks[0].code) {
+            ASSERT(ins.op != bytecode::OpCode::Mult && ins.op != bytecode::OpCode::Add);
+            negations += ins.op == bytecode::OpCode::Not;
+        }
+        // Only not not x is kept, as it turns x into a Bool
+        ASSERT_EQUAL(negations, 2U);
+
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        tree->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "10 -5 ab True True\nTrue False True\n"s);
+
+        // Operations that fail are left to fail when they run
+        ASSERT_THROWS(ParseProgramFromString("print 'before'\nprint 1 / 0\n"s)->Execute(closure, context), std::runtime_error);
+        ASSERT_THROWS(ParseProgramFromString("x = 'a' * 2\n"s)->Execute(closure, context), std::runtime_error);
+        ASSERT_EQUAL(context.output.str(), "10 -5 ab True True\nTrue False True\nbefore\n"s);
+
+        // Integer operations without an int result are not folded, so a branch that never runs
+        // does not trap or overflow while parsing
+        runtime::DummyContext unreached;
+        ParseProgramFromString(R"(
+if False:
+  x = (0 - 2147483647 - 1) / (0 - 1)
+  y = 2147483647 + 1
+  z = 0 - 2147483647 - 2
+  w = 65536 * 65536
+  v = -(0 - 2147483647 - 1)
+print 'parsed', 0 - 2147483647 - 1
+)"s)->Execute(closure, unreached);
+        ASSERT_EQUAL(unreached.output.str(), "parsed -2147483648\n"s);
+        const pair<string, bytecode::OpCode> kept[] = {
+            { "print 2147483647 + 1\n"s, bytecode::OpCode::Add },
+            { "print 0 - 2147483647 - 2\n"s, bytecode::OpCode::Sub },
+            { "print 65536 * 65536\n"s, bytecode::OpCode::Mult },
+            { "print (0 - 2147483647 - 1) / (0 - 1)\n"s, bytecode::OpCode::Div },
+        };
+        for (const auto& [text, op] : kept) {
+            const auto program = bytecode::Compile(*ParseProgramFromString(text));
+            const auto& code = program->chunks[0].code;
+            ASSERT(std::any_of(code.begin(), code.end(), [op = op](const bytecode::Instruction& ins) {
+                return ins.op == op;
+            }));
+        }
+    }
+
 }  // namespace parse
 
 void TestParseProgram(TestRunner& tr) {
@@ -251,8 +505,14 @@ void TestParseProgram(TestRunner& tr) {
     RUN_TEST(tr, parse::TestProgramWithClasses);
     RUN_TEST(tr, parse::TestProgramWithIf);
     RUN_TEST(tr, parse::TestReturnFromIf);
+    RUN_TEST(tr, parse::TestReturnOutsideMethod);
     RUN_TEST(tr, parse::TestRecursion);
     RUN_TEST(tr, parse::TestRecursion2);
     RUN_TEST(tr, parse::TestComplexLogicalExpression);
     RUN_TEST(tr, parse::TestClassicalPolymorphism);
+    RUN_TEST(tr, parse::TestIncrementalEdits);
+    RUN_TEST(tr, parse::TestIncrementalMatchesFullParse);
+    RUN_TEST(tr, parse::TestRetiredClasses);
+    RUN_TEST(tr, parse::TestProgramArena);
+    RUN_TEST(tr, parse::TestConstantFolding);
 }
\ No newline at end of file
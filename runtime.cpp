@@ -1,4 +1,6 @@
 #include "runtime.h"
+#include "arena.h"
+#include "gc.h"
 
 #include <cassert>
 #include <optional>
@@ -9,10 +11,26 @@ using namespace std;
 
 namespace runtime {
 
-    ObjectHolder::ObjectHolder(std::shared_ptr<Object> data) : data_(data) {}
+    ObjectHolder::ObjectHolder(Object* object) : data_(std::in_place_type<Ref>, object) {}
+
+    ObjectHolder::ObjectHolder(Number value) : data_(value) {}
+
+    ObjectHolder::ObjectHolder(Bool value) : data_(value) {}
+
+    ObjectHolder::ObjectHolder(ObjectHolder&& other) noexcept : data_(std::move(other.data_)) {
+        other.data_.emplace<std::monostate>();
+    }
+
+    ObjectHolder& ObjectHolder::operator=(ObjectHolder&& other) noexcept {
+        if (this != &other) {
+            this->data_ = std::move(other.data_);
+            other.data_.emplace<std::monostate>();
+        }
+        return *this;
+    }
 
     void ObjectHolder::AssertIsValid() const {
-        assert(data_ != nullptr);
+        assert(Get() != nullptr);
     }
 
     ObjectHolder ObjectHolder::None() {
@@ -30,13 +48,78 @@ namespace runtime {
     }
 
     Object* ObjectHolder::Get() const {
-        return data_.get();
+        if (auto* ref = std::get_if<Ref>(&this->data_)) {
+            return ref->Get();
+        }
+        if (auto* number = std::get_if<Number>(&this->data_)) {
+            return number;
+        }
+        return std::get_if<Bool>(&this->data_);
     }
 
     ObjectHolder::operator bool() const {
         return Get() != nullptr;
     }
 
+    void Context::SetReturnValue(ObjectHolder value) {
+        this->return_value_ = std::move(value);
+        this->returning_ = true;
+    }
+
+    bool Context::IsReturning() const {
+        return this->returning_;
+    }
+
+    ObjectHolder Context::TakeReturnValue() {
+        this->returning_ = false;
+        return std::move(this->return_value_);
+    }
+
+    size_t Context::PushFrame(size_t size) {
+        const size_t previous_base = this->frame_base_;
+        this->frame_base_ = this->locals_.size();
+        this->locals_.resize(this->frame_base_ + size);
+        return previous_base;
+    }
+
+    void Context::PopFrame(size_t previous_base) {
+        this->locals_.resize(this->frame_base_);
+        this->frame_base_ = previous_base;
+    }
+
+    std::optional<ObjectHolder>& Context::GetLocal(size_t slot) {
+        return this->locals_[this->frame_base_ + slot];
+    }
+
+    const ObjectHolder& Executable::ExecuteBorrowed(Closure& closure, Context& context, ObjectHolder& temp) {
+        temp = this->Execute(closure, context);
+        return temp;
+    }
+
+    bool Executable::MayRunCode() const {
+        return true;
+    }
+
+    namespace {
+        const Symbol SELF = "self";
+        const Symbol STR_METHOD = "__str__";
+        const Symbol EQ_METHOD = "__eq__";
+        const Symbol LT_METHOD = "__lt__";
+        const Symbol ADD_METHOD = "__add__";
+
+        class FrameGuard {
+        public:
+            FrameGuard(Context& context, size_t size) : context_(context), previous_base_(context.PushFrame(size)) {}
+
+            ~FrameGuard() {
+                this->context_.PopFrame(this->previous_base_);
+            }
+        private:
+            Context& context_;
+            size_t previous_base_;
+        };
+    }  // namespace
+
     bool IsTrue(const ObjectHolder& object) {
         if (const String* str = object.TryAs<String>(); str) {
             return str->GetValue().size() != 0;
@@ -51,14 +134,14 @@ namespace runtime {
     }
 
     void ClassInstance::Print(std::ostream& os, Context& context) {
-        if (this->HasMethod("__str__", 0)) {
-            this->Call("__str__", {}, context)->Print(os, context);
+        if (this->HasMethod(STR_METHOD, 0)) {
+            this->Call(STR_METHOD, {}, context)->Print(os, context);
         } else {
             os << this;
         }
     }
 
-    bool ClassInstance::HasMethod(const std::string& method, size_t argument_count) const {
+    bool ClassInstance::HasMethod(Symbol method, size_t argument_count) const {
         const auto* mth_ = this->base_cls_.GetMethod(method);
         if (mth_) {
             return mth_->formal_params.size() == argument_count;
@@ -66,19 +149,96 @@ namespace runtime {
         return false;
     }
 
-    Closure& ClassInstance::Fields() {
-        return this->obj_;
-        throw std::logic_error("Not implemented");
+    const Class& ClassInstance::GetClass() const {
+        return this->base_cls_;
+    }
+
+    const Shape& ClassInstance::GetShape() const {
+        return *this->shape_;
+    }
+
+    ObjectHolder& ClassInstance::GetField(size_t index) {
+        return this->values_[index];
+    }
+
+    const ObjectHolder& ClassInstance::GetField(size_t index) const {
+        return this->values_[index];
+    }
+
+    ObjectHolder* ClassInstance::FindField(Symbol name) {
+        auto index = this->shape_->Find(name);
+        return index ? &this->values_[*index] : nullptr;
+    }
+
+    const ObjectHolder* ClassInstance::FindField(Symbol name) const {
+        auto index = this->shape_->Find(name);
+        return index ? &this->values_[*index] : nullptr;
     }
 
-    const Closure& ClassInstance::Fields() const {
-        return this->obj_;
-        throw std::logic_error("Not implemented");
+    ObjectHolder& ClassInstance::SetField(Symbol name, ObjectHolder value) {
+        if (auto* field = this->FindField(name)) {
+            *field = std::move(value);
+            return *field;
+        }
+        return this->AddField(this->shape_->AddField(name), std::move(value));
+    }
+
+    ObjectHolder& ClassInstance::AddField(const Shape& next, ObjectHolder value) {
+        this->shape_ = &next;
+        this->values_.push_back(std::move(value));
+        return this->values_.back();
+    }
+
+    FieldTable ClassInstance::Fields() {
+        return FieldTable(*this);
+    }
+
+    ConstFieldTable ClassInstance::Fields() const {
+        return ConstFieldTable(*this);
+    }
+
+    ClassInstance::ClassInstance(const Class& cls) : Object(ObjectKind::ClassInstance), base_cls_(cls), shape_(&cls.GetRootShape()) {
+        this->RetainClass();
+        if (auto* collector = CycleCollector::Current()) {
+            collector->Track(*this);
+        }
     }
 
-    ClassInstance::ClassInstance(const Class& cls) : base_cls_(cls) {}
+    ClassInstance::ClassInstance(const ClassInstance& other)
+        : Object(other), base_cls_(other.base_cls_), shape_(other.shape_), values_(other.values_) {
+        this->RetainClass();
+        if (auto* collector = CycleCollector::Current()) {
+            collector->Track(*this);
+        }
+    }
+
+    ClassInstance::ClassInstance(ClassInstance&& other)
+        : Object(other), base_cls_(other.base_cls_), shape_(other.shape_), values_(std::move(other.values_)) {
+        other.shape_ = &other.base_cls_.GetRootShape();
+        this->RetainClass();
+        if (auto* collector = CycleCollector::Current()) {
+            collector->Track(*this);
+        }
+    }
 
-    ObjectHolder ClassInstance::Call(const std::string& method, const std::vector<ObjectHolder>& actual_args, [[maybe_unused]] Context& context) {
+    ClassInstance::~ClassInstance() {
+        if (this->collector_ != nullptr) {
+            this->collector_->Untrack(*this);
+        }
+        // A class that is not owned may be gone already, it is not looked at
+        if (this->counts_class_ && this->base_cls_.Release()) {
+            delete &this->base_cls_;
+        }
+    }
+
+    void ClassInstance::RetainClass() {
+        this->counts_class_ = this->base_cls_.IsOwned();
+        if (this->counts_class_) {
+            this->base_cls_.Retain();
+        }
+    }
+
+    ObjectHolder ClassInstance::Call(Symbol method, const std::vector<ObjectHolder>& actual_args, Context& context) {
         const auto* mth_ = this->base_cls_.GetMethod(method);
         if (mth_ == nullptr) {
             throw std::runtime_error("Not implemented");
@@ -86,30 +246,228 @@ namespace runtime {
         if (actual_args.size() != mth_->formal_params.size()) {
             throw std::runtime_error("Argument count error");
         }
+        return this->Call(*mth_, actual_args, context);
+    }
+
+    namespace {
+        // A body built without a MethodBody leaves the return signal to the call
+        ObjectHolder RunBody(const Method& method, Closure& closure, Context& context) {
+            auto result = method.body->Execute(closure, context);
+            return context.IsReturning() ? context.TakeReturnValue() : result;
+        }
+    }  // namespace
+
+    ObjectHolder ClassInstance::Call(const Method& method, const std::vector<ObjectHolder>& actual_args, Context& context) {
+        if (method.frame_size != 0) {
+            FrameGuard frame(context, method.frame_size);
+            for (size_t ptr = 0; ptr < actual_args.size(); ptr++) {
+                context.GetLocal(ptr) = actual_args[ptr];
+            }
+            context.GetLocal(actual_args.size()) = ObjectHolder::Share(*this);
+            Closure empty;
+            return RunBody(method, empty, context);
+        }
         Closure cls_;
         int ptr = 0;
-        for (const auto& param : mth_->formal_params) {
+        for (const auto& param : method.formal_params) {
             cls_.insert({ param, actual_args[ptr++] });
         }
-        cls_.insert({ "self", ObjectHolder::Share(*this) });
-        return mth_->body->Execute(cls_, context);
+        cls_.insert({ SELF, ObjectHolder::Share(*this) });
+        return RunBody(method, cls_, context);
+    }
+
+    namespace {
+        CallSiteCache* first_call_site = nullptr;
+        CallSiteCache* last_call_site = nullptr;
+    }  // namespace
+
+    CallSiteCache::CallSiteCache(Symbol method) : method_(method), prev_(last_call_site) {
+        if (last_call_site != nullptr) {
+            last_call_site->next_ = this;
+        } else {
+            first_call_site = this;
+        }
+        last_call_site = this;
+    }
+
+    CallSiteCache::~CallSiteCache() {
+        (this->prev_ != nullptr ? this->prev_->next_ : first_call_site) = this->next_;
+        (this->next_ != nullptr ? this->next_->prev_ : last_call_site) = this->prev_;
+    }
+
+    const Method* CallSiteCache::Lookup(const Class& cls, size_t argument_count) {
+        for (size_t ptr = 0; ptr < this->size_; ptr++) {
+            if (this->entries_[ptr].cls == &cls) {
+                ++this->hits_;
+                // The VM shares one cache among the calls of a name, which may pass other counts
+                const auto* method = this->entries_[ptr].method;
+                return method->formal_params.size() == argument_count ? method : nullptr;
+            }
+        }
+        ++this->misses_;
+        const auto* method = cls.GetMethod(this->method_);
+        if (method == nullptr || method->formal_params.size() != argument_count) {
+            return nullptr;
+        }
+        if (this->size_ < MAX_ENTRIES) {
+            this->entries_[this->size_++] = { &cls, method };
+        }
+        return method;
+    }
+
+    const std::string& CallSiteCache::GetName() const {
+        return this->method_.GetName();
+    }
+
+    Symbol CallSiteCache::GetSymbol() const {
+        return this->method_;
+    }
+
+    size_t CallSiteCache::GetHits() const {
+        return this->hits_;
+    }
+
+    size_t CallSiteCache::GetMisses() const {
+        return this->misses_;
     }
 
-    Class::Class(std::string name, std::vector<Method> methods, const Class* parent) : class_name_(name), methods_(std::move(methods)), parrent_class_(parent) {}
+    size_t CallSiteCache::GetSize() const {
+        return this->size_;
+    }
 
-    const Method* Class::GetMethod(const std::string& name) const {
-        for (size_t ptr = 0; ptr < this->methods_.size(); ptr++) {
-            if (this->methods_[ptr].name == name) {
-                return &this->methods_[ptr];
+    void CallSiteCache::DumpStats(std::ostream& os) {
+        for (const auto* site = first_call_site; site != nullptr; site = site->next_) {
+            if (site->hits_ + site->misses_ == 0) {
+                continue;
+            }
+            os << site->method_ << ": " << site->hits_ << " hits, " << site->misses_ << " misses, ";
+            if (site->size_ == MAX_ENTRIES && site->misses_ > MAX_ENTRIES) {
+                os << "megamorphic";
+            } else if (site->size_ > 1) {
+                os << "polymorphic";
+            } else if (site->size_ == 0) {
+                os << "unresolved";
+            } else {
+                os << "monomorphic";
             }
+            os << "\n";
+        }
+    }
+
+    Class::Class(std::string name, std::vector<Method> methods, const Class* parent) : Object(ObjectKind::Class), class_name_(name), methods_(std::move(methods)), parrent_class_(parent), root_shape_(std::make_unique<Shape>()) {
+        if (auto* arena = Arena::Current()) {
+            this->arena_ = arena->weak_from_this().lock();
         }
+        for (const auto& method : this->methods_) {
+            this->method_table_.insert({ method.name, &method });
+        }
+        if (this->parrent_class_ != nullptr) {
+            this->RetainParent();
+            this->method_table_.insert(this->parrent_class_->method_table_.begin(), this->parrent_class_->method_table_.end());
+        }
+    }
+
+    Class::Class(Class&& other)
+        : Object(other), arena_(std::move(other.arena_)), class_name_(std::move(other.class_name_)), methods_(std::move(other.methods_))
+        , parrent_class_(other.parrent_class_), method_table_(std::move(other.method_table_)), root_shape_(std::move(other.root_shape_)) {
         if (this->parrent_class_ != nullptr) {
-            const auto* parent_cls = this->parrent_class_->GetMethod(name);
-            if (parent_cls) {
-                return parent_cls;
+            this->RetainParent();
+        }
+    }
+
+    Class::~Class() {
+        if (this->counts_parent_ && this->parrent_class_->Release()) {
+            delete this->parrent_class_;
+        }
+    }
+
+    void Class::RetainParent() {
+        this->counts_parent_ = this->parrent_class_->IsOwned();
+        if (this->counts_parent_) {
+            this->parrent_class_->Retain();
+        }
+    }
+
+    const Shape& Class::GetRootShape() const {
+        return *this->root_shape_;
+    }
+
+    std::optional<size_t> Shape::Find(Symbol name) const {
+        for (size_t ptr = 0; ptr < this->names_.size(); ptr++) {
+            if (this->names_[ptr] == name) {
+                return ptr;
+            }
+        }
+        return std::nullopt;
+    }
+
+    const Shape& Shape::AddField(Symbol name) const {
+        auto& next = this->transitions_[name];
+        if (!next) {
+            next = std::make_unique<Shape>();
+            next->names_ = this->names_;
+            next->names_.push_back(name);
+        }
+        return *next;
+    }
+
+    size_t Shape::Size() const {
+        return this->names_.size();
+    }
+
+    const std::string& Shape::GetFieldName(size_t index) const {
+        return this->names_[index].GetName();
+    }
+
+    FieldCache::FieldCache(Symbol name) : name_(name) {}
+
+    const std::string& FieldCache::GetName() const {
+        return this->name_.GetName();
+    }
+
+    Symbol FieldCache::GetSymbol() const {
+        return this->name_;
+    }
+
+    ObjectHolder* FieldCache::Find(ClassInstance& instance) {
+        const Shape* shape = &instance.GetShape();
+        if (shape != this->shape_) {
+            auto index = shape->Find(this->name_);
+            if (!index) {
+                return nullptr;
+            }
+            this->shape_ = shape;
+            this->index_ = *index;
+        }
+        return &instance.GetField(this->index_);
+    }
+
+    ObjectHolder& FieldCache::Assign(ClassInstance& instance, ObjectHolder value) {
+        const Shape* shape = &instance.GetShape();
+        if (shape != this->shape_) {
+            if (shape == this->transition_from_) {
+                this->shape_ = this->transition_to_;
+            } else if (auto index = shape->Find(this->name_)) {
+                this->shape_ = shape;
+                this->index_ = *index;
+            } else {
+                this->transition_from_ = shape;
+                this->transition_to_ = &shape->AddField(this->name_);
+                this->shape_ = this->transition_to_;
+            }
+            if (this->shape_ != shape) {
+                this->index_ = this->shape_->Size() - 1;
+                return instance.AddField(*this->shape_, std::move(value));
             }
         }
-        return nullptr;
+        auto& field = instance.GetField(this->index_);
+        field = std::move(value);
+        return field;
+    }
+
+    const Method* Class::GetMethod(Symbol name) const {
+        auto it = this->method_table_.find(name);
+        return it != this->method_table_.end() ? it->second : nullptr;
     }
 
     const std::string& Class::GetName() const {
@@ -119,6 +477,14 @@ namespace runtime {
         throw std::runtime_error("Not implemented");
     }
 
+    const std::vector<Method>& Class::GetMethods() const {
+        return this->methods_;
+    }
+
+    const Class* Class::GetParent() const {
+        return this->parrent_class_;
+    }
+
     void Class::Print(ostream& os, [[maybe_unused]] Context& context) {
         os << "Class " << this->GetName();
     }
@@ -137,8 +503,8 @@ namespace runtime {
         } else if (lhs.TryAs<Bool>() != nullptr && rhs.TryAs<Bool>() != nullptr) {
             return lhs.TryAs<Bool>()->GetValue() == rhs.TryAs<Bool>()->GetValue();
         } else if (lhs.TryAs<ClassInstance>() != nullptr) {
-            if (lhs.TryAs<ClassInstance>()->HasMethod("__eq__", 1)) {
-                return IsTrue(lhs.TryAs<ClassInstance>()->Call("__eq__", { rhs }, context));
+            if (lhs.TryAs<ClassInstance>()->HasMethod(EQ_METHOD, 1)) {
+                return IsTrue(lhs.TryAs<ClassInstance>()->Call(EQ_METHOD, { rhs }, context));
             }
         }
         throw std::runtime_error("Cannot compare objects for equality");
@@ -155,13 +521,50 @@ namespace runtime {
         } else if (lhs.TryAs<Bool>() != nullptr && rhs.TryAs<Bool>() != nullptr) {
             return lhs.TryAs<Bool>()->GetValue() < rhs.TryAs<Bool>()->GetValue();
         } else if (lhs.TryAs<ClassInstance>() != nullptr) {
-            if (lhs.TryAs<ClassInstance>()->HasMethod("__lt__", 1)) {
-                return IsTrue(lhs.TryAs<ClassInstance>()->Call("__lt__", { rhs }, context));
+            if (lhs.TryAs<ClassInstance>()->HasMethod(LT_METHOD, 1)) {
+                return IsTrue(lhs.TryAs<ClassInstance>()->Call(LT_METHOD, { rhs }, context));
             }
         }
         throw std::runtime_error("Cannot compare objects for less"s);
     }
 
+    ObjectHolder Add(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        if (lhs.TryAs<Number>() != nullptr && rhs.TryAs<Number>() != nullptr) {
+            return ObjectHolder::Own(Number(lhs.TryAs<Number>()->GetValue() + rhs.TryAs<Number>()->GetValue()));
+        } else if (lhs.TryAs<String>() != nullptr && rhs.TryAs<String>() != nullptr) {
+            return ObjectHolder::Own(String(lhs.TryAs<String>()->GetValue() + rhs.TryAs<String>()->GetValue()));
+        } else if (lhs.TryAs<ClassInstance>() != nullptr) {
+            if (lhs.TryAs<ClassInstance>()->HasMethod(ADD_METHOD, 1)) {
+                return lhs.TryAs<ClassInstance>()->Call(ADD_METHOD, { rhs }, context);
+            }
+        }
+        throw std::runtime_error("Type add error");
+    }
+
+    ObjectHolder Sub(const ObjectHolder& lhs, const ObjectHolder& rhs, [[maybe_unused]] Context& context) {
+        if (lhs.TryAs<Number>() != nullptr && rhs.TryAs<Number>() != nullptr) {
+            return ObjectHolder::Own(Number(lhs.TryAs<Number>()->GetValue() - rhs.TryAs<Number>()->GetValue()));
+        }
+        throw std::runtime_error("Type sub error");
+    }
+
+    ObjectHolder Mult(const ObjectHolder& lhs, const ObjectHolder& rhs, [[maybe_unused]] Context& context) {
+        if (lhs.TryAs<Number>() != nullptr && rhs.TryAs<Number>() != nullptr) {
+            return ObjectHolder::Own(Number(lhs.TryAs<Number>()->GetValue() * rhs.TryAs<Number>()->GetValue()));
+        }
+        throw std::runtime_error("Type multi error");
+    }
+
+    ObjectHolder Div(const ObjectHolder& lhs, const ObjectHolder& rhs, [[maybe_unused]] Context& context) {
+        if (lhs.TryAs<Number>() != nullptr && rhs.TryAs<Number>() != nullptr) {
+            if (rhs.TryAs<Number>()->GetValue() == 0) {
+                throw std::runtime_error("Divided by zero");
+            }
+            return ObjectHolder::Own(Number(lhs.TryAs<Number>()->GetValue() / rhs.TryAs<Number>()->GetValue()));
+        }
+        throw std::runtime_error("Type sun error");
+    }
+
     bool NotEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
         return !Equal(lhs, rhs, context);
         throw std::runtime_error("Cannot compare objects for equality"s);
@@ -1,38 +1,209 @@
 #pragma once
 
+#include "symbol.h"
+
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 
+namespace bytecode {
+    class Compiler;
+}
+
+namespace ast {
+    class FlatBuilder;
+}
+
 namespace runtime {
 
-    class Context {
-    public:
-        virtual std::ostream& GetOutputStream() = 0;
-    protected:
-        ~Context() = default;
+    class Arena;
+    class Context;
+
+    // Closed set of object types that ObjectHolder::TryAs checks with an integer compare.
+    // The tag is set by the constructor of the tagged type, so it also holds for subclasses
+    // (e.g. of ClassInstance). Anything else is Other and goes through dynamic_cast
+    enum class ObjectKind : uint8_t {
+        Other,
+        String,
+        Number,
+        Bool,
+        Class,
+        ClassInstance,
     };
 
+    // Objects count the ObjectHolders referring to them. An interpreter runs on one thread, so by
+    // default the count is a plain increment; ShareAcrossThreads switches an object to atomic counting
     class Object {
     public:
         virtual ~Object() = default;
         virtual void Print(std::ostream& os, Context& context) = 0;
+
+        [[nodiscard]] ObjectKind GetKind() const {
+            return this->kind_;
+        }
+
+        // Must be called before holders of the object are handed to another thread
+        void ShareAcrossThreads() {
+            this->atomic_ = true;
+        }
+
+        [[nodiscard]] bool IsSharedAcrossThreads() const {
+            return this->atomic_;
+        }
+
+        [[nodiscard]] uint32_t GetRefCount() const {
+            return this->refs_.load(std::memory_order_relaxed);
+        }
+
+        // Created by ObjectHolder::Own and deleted with its last holder
+        [[nodiscard]] bool IsOwned() const {
+            return this->owned_;
+        }
+    protected:
+        explicit Object(ObjectKind kind = ObjectKind::Other) : kind_(kind) {}
+
+        // A copy is a new object: it has no holders yet and is owned by whoever created it
+        Object(const Object& other) : kind_(other.kind_) {}
+
+        Object& operator=(const Object& /*other*/) {
+            return *this;
+        }
+    private:
+        friend class ObjectHolder;
+        // Instances keep an owned class alive, and classes an owned parent
+        friend class Class;
+        friend class ClassInstance;
+
+        void Retain() const noexcept {
+            if (this->atomic_) {
+                this->refs_.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                this->refs_.store(this->refs_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        }
+
+        // True when the last holder of an object created by ObjectHolder::Own is gone
+        [[nodiscard]] bool Release() const noexcept {
+            uint32_t left;
+            if (this->atomic_) {
+                left = this->refs_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+            } else {
+                left = this->refs_.load(std::memory_order_relaxed) - 1;
+                this->refs_.store(left, std::memory_order_relaxed);
+            }
+            return left == 0 && this->owned_;
+        }
+
+        ObjectKind kind_;
+        bool owned_ = false;
+        bool atomic_ = false;
+        mutable std::atomic<uint32_t> refs_ = 0;
     };
 
+    template <typename T>
+    struct KindOf {
+        static constexpr ObjectKind value = ObjectKind::Other;
+    };
+
+    template <typename T>
+    class ValueObject : public Object {
+    public:
+        ValueObject(T v) : Object(KindOf<ValueObject>::value), value_(v) {}
+
+        void Print(std::ostream& os, [[maybe_unused]] Context& context) override {
+            os << value_;
+        }
+
+        [[nodiscard]] const T& GetValue() const {
+            return value_;
+        }
+
+    protected:
+        ValueObject(T v, ObjectKind kind) : Object(kind), value_(v) {}
+    private:
+        T value_;
+    };
+
+    using String = ValueObject<std::string>;
+
+    using Number = ValueObject<int>;
+
+    class Bool : public ValueObject<bool> {
+    public:
+        Bool(bool v) : ValueObject<bool>(v, ObjectKind::Bool) {}
+
+        void Print(std::ostream& os, [[maybe_unused]] Context& context) override;
+    };
+
+    class Class;
+    class ClassInstance;
+    class CycleCollector;
+
+    template <>
+    struct KindOf<String> {
+        static constexpr ObjectKind value = ObjectKind::String;
+    };
+
+    template <>
+    struct KindOf<Number> {
+        static constexpr ObjectKind value = ObjectKind::Number;
+    };
+
+    template <>
+    struct KindOf<Bool> {
+        static constexpr ObjectKind value = ObjectKind::Bool;
+    };
+
+    template <>
+    struct KindOf<Class> {
+        static constexpr ObjectKind value = ObjectKind::Class;
+    };
+
+    template <>
+    struct KindOf<ClassInstance> {
+        static constexpr ObjectKind value = ObjectKind::ClassInstance;
+    };
+
+    // Numbers and booleans are stored inline as tagged values: owning them neither allocates
+    // nor touches a reference count. Any other object is referred to through its own count
     class ObjectHolder {
     public:
         ObjectHolder() = default;
 
+        ObjectHolder(const ObjectHolder&) = default;
+        ObjectHolder& operator=(const ObjectHolder&) = default;
+
+        // A moved-from holder is None whatever it held
+        ObjectHolder(ObjectHolder&& other) noexcept;
+        ObjectHolder& operator=(ObjectHolder&& other) noexcept;
+
+        // The object is deleted with its last holder
         template <typename T>
         [[nodiscard]] static ObjectHolder Own(T&& object) {
-            return ObjectHolder(std::make_shared<T>(std::forward<T>(object)));
+            using Type = std::decay_t<T>;
+            if constexpr (std::is_same_v<Type, Number> || std::is_same_v<Type, Bool>) {
+                return ObjectHolder(Type(std::forward<T>(object)));
+            } else {
+                Object* owned = new Type(std::forward<T>(object));
+                owned->owned_ = true;
+                return ObjectHolder(owned);
+            }
         }
 
+        // The holder counts as a reference but never deletes an object it did not create
         template <typename T>
         [[nodiscard]] static ObjectHolder Share(T& object) {
-            return ObjectHolder(std::shared_ptr<T>(&object, [](auto* /*p*/) { /* do nothing */ }));
+            return ObjectHolder(static_cast<Object*>(&object));
         }
 
         [[nodiscard]] static ObjectHolder None();
@@ -43,92 +214,415 @@ namespace runtime {
 
         [[nodiscard]] Object* Get() const;
 
+        // A pointer to an inline value lives as long as this holder
         template <typename T>
         [[nodiscard]] T* TryAs() const {
-            return dynamic_cast<T*>(this->Get());
+            if constexpr (std::is_same_v<T, Number> || std::is_same_v<T, Bool>) {
+                if (auto* value = std::get_if<T>(&this->data_)) {
+                    return value;
+                }
+            }
+            Object* object = this->Get();
+            if constexpr (KindOf<T>::value != ObjectKind::Other) {
+                return object != nullptr && object->GetKind() == KindOf<T>::value ? static_cast<T*>(object) : nullptr;
+            } else {
+                return dynamic_cast<T*>(object);
+            }
         }
 
         explicit operator bool() const;
     private:
-        explicit ObjectHolder(std::shared_ptr<Object> data);
+        // Counted pointer to an object that is not stored inline
+        class Ref {
+        public:
+            explicit Ref(Object* object) : object_(object) {
+                object->Retain();
+            }
+
+            Ref(const Ref& other) noexcept : object_(other.object_) {
+                this->object_->Retain();
+            }
+
+            // A moved-from Ref is empty, it only gets destroyed
+            Ref(Ref&& other) noexcept : object_(std::exchange(other.object_, nullptr)) {}
+
+            Ref& operator=(const Ref& other) noexcept {
+                other.object_->Retain();
+                this->Reset();
+                this->object_ = other.object_;
+                return *this;
+            }
+
+            Ref& operator=(Ref&& other) noexcept {
+                if (this != &other) {
+                    this->Reset();
+                    this->object_ = std::exchange(other.object_, nullptr);
+                }
+                return *this;
+            }
+
+            ~Ref() {
+                this->Reset();
+            }
+
+            [[nodiscard]] Object* Get() const {
+                return this->object_;
+            }
+        private:
+            void Reset() noexcept {
+                if (this->object_ != nullptr && this->object_->Release()) {
+                    delete this->object_;
+                }
+            }
+
+            Object* object_;
+        };
+
+        explicit ObjectHolder(Object* object);
+        explicit ObjectHolder(Number value);
+        explicit ObjectHolder(Bool value);
         void AssertIsValid() const;
-        std::shared_ptr<Object> data_;
+        mutable std::variant<std::monostate, Ref, Number, Bool> data_;
     };
 
-    template <typename T>
-    class ValueObject : public Object {
+    class Context {
     public:
-        ValueObject(T v) : value_(v) {}
+        virtual std::ostream& GetOutputStream() = 0;
 
-        void Print(std::ostream& os, [[maybe_unused]] Context& context) override {
-            os << value_;
-        }
+        // Completion signal of ast::Return. Compound stops and IfElse passes it along
+        // until the enclosing MethodBody takes the value
+        void SetReturnValue(ObjectHolder value);
 
-        [[nodiscard]] const T& GetValue() const {
-            return value_;
-        }
+        [[nodiscard]] bool IsReturning() const;
+
+        ObjectHolder TakeReturnValue();
+
+        // Slots of the resolved local variables of the running method, see Method::frame_size.
+        // PushFrame returns the previous frame base to be handed back to PopFrame
+        size_t PushFrame(size_t size);
+
+        void PopFrame(size_t previous_base);
 
+        // An empty optional is a local that is not assigned yet
+        [[nodiscard]] std::optional<ObjectHolder>& GetLocal(size_t slot);
+    protected:
+        ~Context() = default;
     private:
-        T value_;
+        ObjectHolder return_value_;
+        bool returning_ = false;
+        std::vector<std::optional<ObjectHolder>> locals_;
+        size_t frame_base_ = 0;
     };
 
-    using Closure = std::unordered_map<std::string, ObjectHolder>;
+    using Closure = std::unordered_map<Symbol, ObjectHolder>;
 
     bool IsTrue(const ObjectHolder& object);
 
     class Executable {
     public:
         virtual ~Executable() = default;
+        // Nodes created under an Arena::Scope are placed in its arena, see arena.h
+        static void* operator new(size_t size);
+        static void operator delete(void* ptr);
         virtual ObjectHolder Execute(Closure& closure, Context& context) = 0;
+        // Value of the node for a caller that reads it right away. Variables, fields and constants
+        // return the holder they keep, without a copy; the other nodes put their result in temp.
+        // The reference is valid until Mython code runs, which may replace or move the holder
+        virtual const ObjectHolder& ExecuteBorrowed(Closure& closure, Context& context, ObjectHolder& temp);
+        // False for the nodes that evaluate without running Mython code
+        [[nodiscard]] virtual bool MayRunCode() const;
+        // Lowers the node into bytecode. Nodes without their own lowering are run by the tree-walker
+        virtual void Compile(bytecode::Compiler& compiler);
+        // Appends the node to a flat expression and returns its index, see flat.h. Nodes without
+        // their own flat form become leaves that are run with Execute
+        virtual uint32_t Flatten(ast::FlatBuilder& builder);
     };
 
-    using String = ValueObject<std::string>;
-
-    using Number = ValueObject<int>;
+    struct Method {
+        Symbol name;
+        std::vector<Symbol> formal_params;
+        std::unique_ptr<Executable> body;
+        // Number of local slots of a body resolved by the parser: the parameters go first,
+        // then self, then the other locals. Zero means the body reads its locals from the Closure
+        size_t frame_size = 0;
+    };
 
-    class Bool : public ValueObject<bool> {
+    // Field layout shared by all instances that got the same fields in the same order. Shapes
+    // form a transition tree rooted at their Class and never change once created
+    class Shape {
     public:
-        using ValueObject<bool>::ValueObject;
+        Shape() = default;
 
-        void Print(std::ostream& os, [[maybe_unused]] Context& context) override;
-    };
+        Shape(const Shape&) = delete;
+        Shape& operator=(const Shape&) = delete;
 
-    struct Method {
-        std::string name;
-        std::vector<std::string> formal_params;
-        std::unique_ptr<Executable> body;
+        [[nodiscard]] std::optional<size_t> Find(Symbol name) const;
+
+        // The shape with one more field, created on first use
+        [[nodiscard]] const Shape& AddField(Symbol name) const;
+
+        [[nodiscard]] size_t Size() const;
+
+        [[nodiscard]] const std::string& GetFieldName(size_t index) const;
+    private:
+        std::vector<Symbol> names_;
+        mutable std::unordered_map<Symbol, std::unique_ptr<Shape>> transitions_;
     };
 
     class Class : public Object {
     public:
+        // A class parsed under an Arena::Scope keeps the arena holding its method bodies
         explicit Class(std::string name, std::vector<Method> methods, const Class* parent);
 
-        [[nodiscard]] const Method* GetMethod(const std::string& name) const;
+        Class(Class&& other);
+
+        ~Class() override;
+
+        [[nodiscard]] const Method* GetMethod(Symbol name) const;
 
         [[nodiscard]] const std::string& GetName() const;
 
+        [[nodiscard]] const std::vector<Method>& GetMethods() const;
+
+        [[nodiscard]] const Class* GetParent() const;
+
+        // Shape of a fresh instance, without fields
+        [[nodiscard]] const Shape& GetRootShape() const;
+
         void Print(std::ostream& os, [[maybe_unused]] Context& context) override;
     private:
+        void RetainParent();
+
+        // Declared before the methods, so it outlives them
+        std::shared_ptr<Arena> arena_;
         std::string class_name_;
         std::vector<Method> methods_;
         const Class* parrent_class_;
+        bool counts_parent_ = false;
+        // Own and inherited methods resolved at construction
+        std::unordered_map<Symbol, const Method*> method_table_;
+        std::unique_ptr<Shape> root_shape_;
     };
 
+    template <typename Instance>
+    class BasicFieldTable;
+
+    using FieldTable = BasicFieldTable<ClassInstance>;
+    using ConstFieldTable = BasicFieldTable<const ClassInstance>;
+
     class ClassInstance : public Object {
     public:
+        // The instance counts as a holder of an owned class, which goes with its last instance.
+        // A class that is not owned must outlive its instances
         explicit ClassInstance(const Class& cls);
 
+        // A copy is tracked by the current CycleCollector like a new instance
+        ClassInstance(const ClassInstance& other);
+        ClassInstance(ClassInstance&& other);
+
+        ~ClassInstance() override;
+
         void Print(std::ostream& os, Context& context) override;
 
-        ObjectHolder Call(const std::string& method, const std::vector<ObjectHolder>& actual_args, Context& context);
+        ObjectHolder Call(Symbol method, const std::vector<ObjectHolder>& actual_args, Context& context);
+
+        // Calls a method already looked up in the class of the instance, with a matching number of arguments
+        ObjectHolder Call(const Method& method, const std::vector<ObjectHolder>& actual_args, Context& context);
+
+        [[nodiscard]] bool HasMethod(Symbol method, size_t argument_count) const;
+
+        [[nodiscard]] const Class& GetClass() const;
 
-        [[nodiscard]] bool HasMethod(const std::string& method, size_t argument_count) const;
+        // Field values are stored in the order of the shape
+        [[nodiscard]] const Shape& GetShape() const;
 
-        [[nodiscard]] Closure& Fields();
-        [[nodiscard]] const Closure& Fields() const;
+        [[nodiscard]] ObjectHolder& GetField(size_t index);
+        [[nodiscard]] const ObjectHolder& GetField(size_t index) const;
+
+        [[nodiscard]] ObjectHolder* FindField(Symbol name);
+        [[nodiscard]] const ObjectHolder* FindField(Symbol name) const;
+
+        // Adds the field when it is missing
+        ObjectHolder& SetField(Symbol name, ObjectHolder value);
+
+        // Moves to next, a transition of the current shape by one field, and stores the new field
+        ObjectHolder& AddField(const Shape& next, ObjectHolder value);
+
+        [[nodiscard]] FieldTable Fields();
+        [[nodiscard]] ConstFieldTable Fields() const;
     private:
+        friend class CycleCollector;
+
+        void RetainClass();
+
         const Class& base_cls_;
-        Closure obj_;
+        const Shape* shape_;
+        std::vector<ObjectHolder> values_;
+
+        // Links of the instances tracked by the same collector, and its scratch during a collection
+        CycleCollector* collector_ = nullptr;
+        ClassInstance* gc_prev_ = nullptr;
+        ClassInstance* gc_next_ = nullptr;
+        size_t gc_refs_ = 0;
+        bool gc_reachable_ = false;
+        // Young instances get promoted to the old generation after surviving a few collections
+        bool gc_old_ = false;
+        uint8_t gc_age_ = 0;
+        // Set when the class is owned and the instance holds it
+        bool counts_class_ = false;
+    };
+
+    // Name-keyed view of the instance fields with the interface of the former field map
+    template <typename Instance>
+    class BasicFieldTable {
+    public:
+        using Value = std::conditional_t<std::is_const_v<Instance>, const ObjectHolder, ObjectHolder>;
+
+        struct Field {
+            const std::string& first;
+            Value& second;
+        };
+
+        class Iterator {
+        public:
+            struct Arrow {
+                Field field;
+
+                const Field* operator->() const {
+                    return &this->field;
+                }
+            };
+
+            Iterator(Instance& instance, size_t index) : instance_(&instance), index_(index) {}
+
+            Field operator*() const {
+                return { this->instance_->GetShape().GetFieldName(this->index_), this->instance_->GetField(this->index_) };
+            }
+
+            Arrow operator->() const {
+                return { **this };
+            }
+
+            Iterator& operator++() {
+                ++this->index_;
+                return *this;
+            }
+
+            bool operator==(const Iterator& other) const {
+                return this->instance_ == other.instance_ && this->index_ == other.index_;
+            }
+
+            bool operator!=(const Iterator& other) const {
+                return !(*this == other);
+            }
+        private:
+            Instance* instance_;
+            size_t index_;
+        };
+
+        explicit BasicFieldTable(Instance& instance) : instance_(instance) {}
+
+        [[nodiscard]] Iterator begin() const {
+            return Iterator(this->instance_, 0);
+        }
+
+        [[nodiscard]] Iterator end() const {
+            return Iterator(this->instance_, this->size());
+        }
+
+        [[nodiscard]] Iterator find(Symbol name) const {
+            auto index = this->instance_.GetShape().Find(name);
+            return index ? Iterator(this->instance_, *index) : this->end();
+        }
+
+        [[nodiscard]] size_t count(Symbol name) const {
+            return this->instance_.GetShape().Find(name) ? 1 : 0;
+        }
+
+        [[nodiscard]] size_t size() const {
+            return this->instance_.GetShape().Size();
+        }
+
+        Value& at(Symbol name) const {
+            auto* value = this->instance_.FindField(name);
+            if (value == nullptr) {
+                throw std::out_of_range("No field " + name.GetName());
+            }
+            return *value;
+        }
+
+        ObjectHolder& operator[](Symbol name) const {
+            auto* value = this->instance_.FindField(name);
+            return value != nullptr ? *value : this->instance_.SetField(name, ObjectHolder::None());
+        }
+    private:
+        Instance& instance_;
+    };
+
+    // Inline cache of one field access site: the field index in the last shape seen there and
+    // the last shape transition made by assigning a new field
+    class FieldCache {
+    public:
+        explicit FieldCache(Symbol name);
+
+        [[nodiscard]] const std::string& GetName() const;
+
+        [[nodiscard]] Symbol GetSymbol() const;
+
+        [[nodiscard]] ObjectHolder* Find(ClassInstance& instance);
+
+        ObjectHolder& Assign(ClassInstance& instance, ObjectHolder value);
+    private:
+        Symbol name_;
+        const Shape* shape_ = nullptr;
+        size_t index_ = 0;
+        const Shape* transition_from_ = nullptr;
+        const Shape* transition_to_ = nullptr;
+    };
+
+    // Inline cache of one method call site: the methods found for up to MAX_ENTRIES receiver
+    // classes. A site that has seen more classes than that looks the method up on every call.
+    // Live call sites are listed for DumpStats, which is not thread-safe
+    class CallSiteCache {
+    public:
+        static constexpr size_t MAX_ENTRIES = 4;
+
+        explicit CallSiteCache(Symbol method);
+
+        CallSiteCache(const CallSiteCache&) = delete;
+        CallSiteCache& operator=(const CallSiteCache&) = delete;
+
+        ~CallSiteCache();
+
+        // nullptr when the class has no such method taking argument_count params
+        [[nodiscard]] const Method* Lookup(const Class& cls, size_t argument_count);
+
+        [[nodiscard]] const std::string& GetName() const;
+
+        [[nodiscard]] Symbol GetSymbol() const;
+
+        [[nodiscard]] size_t GetHits() const;
+
+        [[nodiscard]] size_t GetMisses() const;
+
+        // Number of cached classes: 1 is a monomorphic site
+        [[nodiscard]] size_t GetSize() const;
+
+        // Prints a line with the counters of each live call site that was reached, oldest first
+        static void DumpStats(std::ostream& os);
+    private:
+        struct Entry {
+            const Class* cls = nullptr;
+            const Method* method = nullptr;
+        };
+
+        Symbol method_;
+        Entry entries_[MAX_ENTRIES];
+        size_t size_ = 0;
+        size_t hits_ = 0;
+        size_t misses_ = 0;
+        CallSiteCache* prev_ = nullptr;
+        CallSiteCache* next_ = nullptr;
     };
 
     bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, [[maybe_unused]] Context& context);
@@ -143,6 +637,14 @@ namespace runtime {
     
     bool GreaterOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
 
+    ObjectHolder Add(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+
+    ObjectHolder Sub(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+
+    ObjectHolder Mult(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+
+    ObjectHolder Div(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+
     struct DummyContext : Context {
         std::ostream& GetOutputStream() override {
             return output;
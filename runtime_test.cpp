@@ -1,7 +1,11 @@
+#include "arena.h"
+#include "gc.h"
 #include "runtime.h"
 #include "test_runner_p.h"
 
 #include <functional>
+#include <memory>
+#include <thread>
 
 using namespace std;
 
@@ -16,7 +20,7 @@ namespace runtime {
                 ++instance_count;
             }
 
-            Logger(const Logger& rhs) : id_(rhs.id_) {
+            Logger(const Logger& rhs) : Object(rhs), id_(rhs.id_) {
                 ++instance_count;
             }
 
@@ -216,25 +220,440 @@ namespace runtime {
             }
         }
 
+        void TestInlineValues() {
+            auto num = ObjectHolder::Own(Number(42));
+            auto copy = num;
+            ASSERT(num.TryAs<Number>() != copy.TryAs<Number>());
+            ASSERT_EQUAL(copy.TryAs<Number>()->GetValue(), 42);
+            ASSERT(num.TryAs<Bool>() == nullptr);
+            ASSERT(num.TryAs<String>() == nullptr);
+            ASSERT(num.TryAs<Object>() == num.Get());
+
+            auto flag = ObjectHolder::Own(Bool(true));
+            ASSERT(flag.TryAs<Number>() == nullptr);
+            ASSERT(flag.TryAs<ValueObject<bool>>() == flag.TryAs<Bool>());
+
+            Number shared_num(7);
+            auto shared = ObjectHolder::Share(shared_num);
+            ASSERT(shared.TryAs<Number>() == &shared_num);
+
+            DummyContext context;
+            num->Print(context.output, context);
+            flag->Print(context.output, context);
+            ASSERT_EQUAL(context.output.str(), "42True"s);
+
+            ObjectHolder moved = std::move(num);
+            ASSERT(!num);  // NOLINT
+            ASSERT_EQUAL(moved.TryAs<Number>()->GetValue(), 42);
+        }
+
+        void TestTypeTags() {
+            class Counter : public ClassInstance {
+            public:
+                using ClassInstance::ClassInstance;
+            };
+
+            Class cls("Counter"s, {}, nullptr);
+            auto counter = ObjectHolder::Own(Counter(cls));
+            ASSERT(counter->GetKind() == ObjectKind::ClassInstance);
+            ASSERT(counter.TryAs<ClassInstance>() == counter.Get());
+            ASSERT(counter.TryAs<Counter>() == counter.Get());
+            ASSERT(counter.TryAs<Class>() == nullptr);
+
+            auto plain_bool = ObjectHolder::Own(ValueObject<bool>(true));
+            ASSERT(plain_bool->GetKind() == ObjectKind::Other);
+            ASSERT(plain_bool.TryAs<Bool>() == nullptr);
+            ASSERT(plain_bool.TryAs<ValueObject<bool>>() != nullptr);
+
+            auto logger = ObjectHolder::Own(Logger());
+            ASSERT(logger.TryAs<String>() == nullptr);
+            ASSERT(logger.TryAs<Logger>() != nullptr);
+            ASSERT(ObjectHolder::None().TryAs<ClassInstance>() == nullptr);
+        }
+
+        void TestRefCount() {
+            ASSERT_EQUAL(Logger::instance_count, 0);
+            {
+                auto one = ObjectHolder::Own(Logger(5));
+                ASSERT_EQUAL(one->GetRefCount(), 1U);
+                {
+                    auto two = one;
+                    ObjectHolder three;
+                    three = two;
+                    ASSERT_EQUAL(one->GetRefCount(), 3U);
+                    ObjectHolder four = std::move(three);
+                    ASSERT_EQUAL(one->GetRefCount(), 3U);
+                }
+                ASSERT_EQUAL(one->GetRefCount(), 1U);
+                one = ObjectHolder::Own(Logger(6));
+                ASSERT_EQUAL(Logger::instance_count, 1);
+                ASSERT_EQUAL(one.TryAs<Logger>()->GetId(), 6);
+            }
+            ASSERT_EQUAL(Logger::instance_count, 0);
+
+            Logger logger(7);
+            {
+                auto shared = ObjectHolder::Share(logger);
+                auto copy = shared;
+                ASSERT_EQUAL(logger.GetRefCount(), 2U);
+
+                // A copied object starts without holders
+                auto owned_copy = ObjectHolder::Own(Logger(logger));
+                ASSERT_EQUAL(owned_copy->GetRefCount(), 1U);
+            }
+            ASSERT_EQUAL(logger.GetRefCount(), 0U);
+            ASSERT_EQUAL(Logger::instance_count, 1);
+        }
+
+        void TestAtomicRefCount() {
+            auto text = ObjectHolder::Own(String("shared"s));
+            ASSERT(!text->IsSharedAcrossThreads());
+            text->ShareAcrossThreads();
+            ASSERT(text->IsSharedAcrossThreads());
+
+            vector<thread> threads;
+            for (int t = 0; t < 4; t++) {
+                threads.emplace_back([text] {
+                    for (int i = 0; i < 100'000; i++) {
+                        ObjectHolder copy = text;
+                    }
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+            ASSERT_EQUAL(text->GetRefCount(), 1U);
+            ASSERT_EQUAL(text.TryAs<String>()->GetValue(), "shared"s);
+        }
+
         void TestNullptr() {
             ObjectHolder oh;
             ASSERT(!oh);
             ASSERT(!oh.Get());
         }
 
+        // Counts its instances, so the tests see what the collector frees
+        class Node : public ClassInstance {
+        public:
+            static int instance_count;
+
+            explicit Node(const Class& cls) : ClassInstance(cls) {
+                ++instance_count;
+            }
+
+            Node(const Node& other) : ClassInstance(other) {
+                ++instance_count;
+            }
+
+            ~Node() override {
+                --instance_count;
+            }
+        };
+
+        int Node::instance_count = 0;
+
+        ObjectHolder MakePair(const Class& cls) {
+            auto a = ObjectHolder::Own(Node(cls));
+            auto b = ObjectHolder::Own(Node(cls));
+            a.TryAs<ClassInstance>()->SetField("peer"s, b);
+            b.TryAs<ClassInstance>()->SetField("peer"s, a);
+            return a;
+        }
+
+        void TestCycleCollector() {
+            Class cls("Node"s, {}, nullptr);
+            {
+                CycleCollector collector(1'000'000);
+                CycleCollector::Scope scope(collector);
+
+                // A cycle that is only referred to by itself
+                MakePair(cls);
+                ASSERT_EQUAL(Node::instance_count, 2);
+
+                // A cycle with a holder outside, and a tree with back links reachable from it
+                auto kept = MakePair(cls);
+                auto child = ObjectHolder::Own(Node(cls));
+                child.TryAs<ClassInstance>()->SetField("parent"s, kept);
+                kept.TryAs<ClassInstance>()->SetField("child"s, std::move(child));
+
+                // An instance on the C++ stack refers to a cycle of its own
+                Node local(cls);
+                local.SetField("pair"s, MakePair(cls));
+
+                ASSERT_EQUAL(collector.GetTrackedCount(), 8U);
+                ASSERT_EQUAL(collector.Collect(), 2U);
+                ASSERT_EQUAL(Node::instance_count, 6);
+                ASSERT_EQUAL(collector.Collect(), 0U);
+
+                kept = ObjectHolder::None();
+                local.SetField("pair"s, ObjectHolder::None());
+                ASSERT_EQUAL(collector.Collect(), 5U);
+                ASSERT_EQUAL(Node::instance_count, 1);
+                ASSERT_EQUAL(collector.GetStats().collections, 3U);
+                ASSERT_EQUAL(collector.GetStats().freed, 7U);
+
+                // Left to the destructor of the collector
+                MakePair(cls);
+            }
+            ASSERT_EQUAL(Node::instance_count, 0);
+
+            // Outside of a scope nothing is tracked
+            ObjectHolder untracked = ObjectHolder::Own(Node(cls));
+            CycleCollector collector;
+            ASSERT_EQUAL(collector.Collect(), 0U);
+            ASSERT_EQUAL(Node::instance_count, 1);
+        }
+
+        void TestCycleCollectorStress() {
+            Class cls("Node"s, {}, nullptr);
+            CycleCollector collector;
+            CycleCollector::Scope scope(collector);
+            auto kept = MakePair(cls);
+            for (int i = 0; i < 200'000; i++) {
+                MakePair(cls);
+                // Collections start on their own and keep the garbage bounded
+                ASSERT(collector.GetTrackedCount() <= 2 * CycleCollector::DEFAULT_THRESHOLD + 2);
+            }
+            collector.Collect();
+            ASSERT_EQUAL(collector.GetTrackedCount(), 2U);
+            ASSERT_EQUAL(Node::instance_count, 2);
+            ASSERT(collector.GetStats().collections >= 20U);
+            ASSERT(collector.GetStats().max_pause >= collector.GetStats().last_pause);
+        }
+
+        void TestGenerationalCollector() {
+            Class cls("Node"s, {}, nullptr);
+            {
+                CycleCollector collector(CollectorMode::Generational, 1'000'000);
+                CycleCollector::Scope scope(collector);
+                ASSERT(collector.GetMode() == CollectorMode::Generational);
+
+                auto kept = MakePair(cls);
+                for (int i = 0; i < CycleCollector::PROMOTION_AGE; i++) {
+                    ASSERT_EQUAL(collector.GetOldCount(), 0U);
+                    collector.CollectYoung();
+                }
+                ASSERT_EQUAL(collector.GetOldCount(), 2U);
+                ASSERT_EQUAL(collector.GetStats().promoted, 2U);
+
+                // A young instance referred to by an old one only survives minor collections
+                kept.TryAs<ClassInstance>()->SetField("child"s, ObjectHolder::Own(Node(cls)));
+                MakePair(cls);
+                ASSERT_EQUAL(collector.CollectYoung(), 2U);
+                ASSERT_EQUAL(Node::instance_count, 3);
+
+                // An old cycle waits for a major collection
+                kept = ObjectHolder::None();
+                ASSERT_EQUAL(collector.CollectYoung(), 0U);
+                ASSERT_EQUAL(Node::instance_count, 3);
+                ASSERT_EQUAL(collector.Collect(), 3U);
+                ASSERT_EQUAL(Node::instance_count, 0);
+                ASSERT_EQUAL(collector.GetOldCount(), 0U);
+                ASSERT_EQUAL(collector.GetStats().minor_collections, 4U);
+                ASSERT_EQUAL(collector.GetStats().collections, 5U);
+            }
+
+            // Collections start on their own, the long-lived list ends up in the old generation
+            CycleCollector collector(CollectorMode::Generational, 1'000);
+            CycleCollector::Scope scope(collector);
+            ObjectHolder list;
+            for (int i = 0; i < 5'000; i++) {
+                auto node = ObjectHolder::Own(Node(cls));
+                node.TryAs<ClassInstance>()->SetField("next"s, std::move(list));
+                list = std::move(node);
+            }
+            for (int i = 0; i < 50'000; i++) {
+                MakePair(cls);
+                ASSERT(collector.GetTrackedCount() <= 5'000 + 4 * 1'000);
+            }
+            ASSERT(collector.GetOldCount() >= 4'000U);
+            ASSERT(collector.GetStats().minor_collections > collector.GetStats().collections / 2);
+            list = ObjectHolder::None();
+            collector.Collect();
+            ASSERT_EQUAL(collector.GetTrackedCount(), 0U);
+            ASSERT_EQUAL(Node::instance_count, 0);
+        }
+
+        void TestShapes() {
+            Class cls("Point"s, {}, nullptr);
+            ClassInstance a(cls);
+            ClassInstance b(cls);
+            ClassInstance c(cls);
+            ASSERT(&a.GetShape() == &cls.GetRootShape());
+
+            a.SetField("x"s, ObjectHolder::Own(Number(1)));
+            a.SetField("y"s, ObjectHolder::Own(Number(2)));
+            b.Fields()["x"s] = ObjectHolder::Own(Number(3));
+            b.Fields()["y"s] = ObjectHolder::Own(Number(4));
+            c.SetField("y"s, ObjectHolder::Own(Number(5)));
+            ASSERT(&a.GetShape() == &b.GetShape());
+            ASSERT(&a.GetShape() != &c.GetShape());
+            ASSERT_EQUAL(a.GetShape().Size(), 2U);
+
+            a.SetField("x"s, ObjectHolder::Own(Number(10)));
+            ASSERT(&a.GetShape() == &b.GetShape());
+            ASSERT_EQUAL(a.Fields().at("x"s).TryAs<Number>()->GetValue(), 10);
+            ASSERT_EQUAL(c.Fields().count("x"s), 0U);
+            ASSERT(c.Fields().find("x"s) == c.Fields().end());
+            ASSERT_THROWS(c.Fields().at("x"s), std::out_of_range);
+
+            std::string names;
+            const ClassInstance& const_b = b;
+            for (const auto& field : const_b.Fields()) {
+                names += field.first + std::to_string(field.second.TryAs<Number>()->GetValue());
+            }
+            ASSERT_EQUAL(names, "x3y4"s);
+        }
+
+        void TestFieldCache() {
+            Class cls("Point"s, {}, nullptr);
+            ClassInstance a(cls);
+            ClassInstance b(cls);
+            ClassInstance c(cls);
+            c.SetField("z"s, ObjectHolder::None());
+
+            FieldCache x("x"s);
+            ASSERT(x.Find(a) == nullptr);
+            for (auto* instance : { &a, &b, &c }) {
+                x.Assign(*instance, ObjectHolder::Own(Number(1)));
+            }
+            ASSERT(&a.GetShape() == &b.GetShape());
+            ASSERT_EQUAL(c.GetShape().GetFieldName(1), "x"s);
+            for (auto* instance : { &a, &b, &c }) {
+                ASSERT(x.Find(*instance) == instance->FindField("x"s));
+            }
+
+            x.Assign(c, ObjectHolder::Own(Number(2)));
+            ASSERT_EQUAL(c.FindField("x"s)->TryAs<Number>()->GetValue(), 2);
+            ASSERT_EQUAL(c.GetShape().Size(), 2U);
+        }
+
+        void TestCallSiteCache() {
+            auto make_class = [](const std::string& name, const Class* parent) {
+                vector<Method> methods;
+                methods.push_back({ "f"s, { "x"s }, nullptr });
+                return Class(name, std::move(methods), parent);
+            };
+            const Class base = make_class("Base"s, nullptr);
+            const Class child("Child"s, {}, &base);
+
+            CallSiteCache site("f"s);
+            ASSERT(site.Lookup(base, 1) == base.GetMethod("f"s));
+            ASSERT(site.Lookup(base, 1) == base.GetMethod("f"s));
+            ASSERT(site.Lookup(child, 1) == base.GetMethod("f"s));
+            ASSERT(site.Lookup(child, 2) == nullptr);
+            ASSERT_EQUAL(site.GetSize(), 2U);
+            ASSERT_EQUAL(site.GetHits(), 2U);
+            ASSERT_EQUAL(site.GetMisses(), 2U);
+
+            CallSiteCache wrong_arity("f"s);
+            ASSERT(wrong_arity.Lookup(base, 0) == nullptr);
+            ASSERT_EQUAL(wrong_arity.GetSize(), 0U);
+
+            vector<Class> classes;
+            for (size_t i = 0; i <= CallSiteCache::MAX_ENTRIES; i++) {
+                classes.push_back(make_class("C"s + std::to_string(i), nullptr));
+            }
+            CallSiteCache megamorphic("f"s);
+            for (const auto& cls : classes) {
+                ASSERT(megamorphic.Lookup(cls, 1) == cls.GetMethod("f"s));
+            }
+            ASSERT(megamorphic.Lookup(classes.back(), 1) == classes.back().GetMethod("f"s));
+            ASSERT_EQUAL(megamorphic.GetSize(), CallSiteCache::MAX_ENTRIES);
+            ASSERT_EQUAL(megamorphic.GetHits(), 0U);
+
+            ostringstream stats;
+            CallSiteCache::DumpStats(stats);
+            ASSERT_EQUAL(stats.str(), "f: 2 hits, 2 misses, polymorphic\nf: 0 hits, 1 misses, unresolved\n"s
+                "f: 0 hits, 6 misses, megamorphic\n"s);
+        }
+
+        void TestMethodTable() {
+            vector<std::unique_ptr<Class>> chain;
+            for (int level = 0; level < 8; level++) {
+                vector<Method> methods;
+                methods.push_back({ "level"s + std::to_string(level), {}, nullptr });
+                if (level % 3 == 0) {
+                    methods.push_back({ "__str__"s, {}, nullptr });
+                    methods.push_back({ "__str__"s, { "shadowed"s }, nullptr });
+                }
+                chain.push_back(std::make_unique<Class>("L"s + std::to_string(level), std::move(methods), chain.empty() ? nullptr : chain.back().get()));
+            }
+
+            const Class& leaf = *chain.back();
+            for (int level = 0; level < 8; level++) {
+                ASSERT(leaf.GetMethod("level"s + std::to_string(level)) == &chain[level]->GetMethods().front());
+            }
+            ASSERT(leaf.GetMethod("__str__"s) == &chain[6]->GetMethods()[1]);
+            ASSERT(leaf.GetMethod("__str__"s)->formal_params.empty());
+            ASSERT(chain[5]->GetMethod("__str__"s) == &chain[3]->GetMethods()[1]);
+            ASSERT(leaf.GetMethod("missing"s) == nullptr);
+        }
+
+        void TestClassLifetime() {
+            // The body holds the token, so the token goes when the class does
+            auto token = std::make_shared<int>(0);
+            const std::weak_ptr<int> base_alive = token;
+            auto arena = std::make_shared<Arena>();
+            const std::weak_ptr<Arena> arena_alive = arena;
+            ObjectHolder base;
+            ObjectHolder child;
+            {
+                Arena::Scope scope(*arena);
+                vector<Method> methods;
+                methods.push_back({ "get"s, {}, make_unique<TestMethodBody>([token](Closure&, Context&) {
+                    return ObjectHolder::Own(Number{ *token + 1 });
+                }) });
+                base = ObjectHolder::Own(Class("Base"s, std::move(methods), nullptr));
+                child = ObjectHolder::Own(Class("Child"s, {}, base.TryAs<Class>()));
+            }
+            token.reset();
+            arena.reset();
+
+            // The instance keeps its class, the class its parent and the arena of the methods
+            auto instance = ObjectHolder::Own(ClassInstance(*child.TryAs<Class>()));
+            base = ObjectHolder::None();
+            child = ObjectHolder::None();
+            ASSERT(!base_alive.expired());
+            ASSERT(!arena_alive.expired());
+            DummyContext context;
+            ASSERT_EQUAL(instance.TryAs<ClassInstance>()->Call("get"s, {}, context).TryAs<Number>()->GetValue(), 1);
+
+            instance = ObjectHolder::None();
+            ASSERT(base_alive.expired());
+            ASSERT(arena_alive.expired());
+
+            // Classes that are not owned are not counted
+            const Class local("Local"s, {}, nullptr);
+            ClassInstance local_instance(local);
+            ASSERT_EQUAL(local.GetRefCount(), 0U);
+        }
+
     }  // namespace
 
     void RunObjectsTests(TestRunner& tr) {
         RUN_TEST(tr, runtime::TestNumber);
         RUN_TEST(tr, runtime::TestString);
         RUN_TEST(tr, runtime::TestMethodInvocation);
+        RUN_TEST(tr, runtime::TestShapes);
+        RUN_TEST(tr, runtime::TestFieldCache);
+        RUN_TEST(tr, runtime::TestCallSiteCache);
+        RUN_TEST(tr, runtime::TestMethodTable);
+        RUN_TEST(tr, runtime::TestClassLifetime);
+        RUN_TEST(tr, runtime::TestCycleCollector);
+        RUN_TEST(tr, runtime::TestCycleCollectorStress);
+        RUN_TEST(tr, runtime::TestGenerationalCollector);
     }
 
     void RunObjectHolderTests(TestRunner& tr) {
         RUN_TEST(tr, runtime::TestNonowning);
         RUN_TEST(tr, runtime::TestOwning);
         RUN_TEST(tr, runtime::TestMove);
+        RUN_TEST(tr, runtime::TestInlineValues);
+        RUN_TEST(tr, runtime::TestTypeTags);
         RUN_TEST(tr, runtime::TestNullptr);
+        RUN_TEST(tr, runtime::TestRefCount);
+        RUN_TEST(tr, runtime::TestAtomicRefCount);
     }
 
 }  // namespace runtime
\ No newline at end of file
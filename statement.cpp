@@ -1,5 +1,8 @@
 #include "statement.h"
 
+#include "bytecode.h"
+#include "flat.h"
+
 #include <iostream>
 #include <sstream>
 #include <unordered_map>
@@ -14,41 +17,135 @@ namespace ast {
     using runtime::ObjectHolder;
 
     namespace {
-        const string ADD_METHOD = "__add__"s;
-        const string INIT_METHOD = "__init__"s;
-    }  // namespace ast
+        const runtime::Symbol INIT_METHOD = "__init__";
+
+        // Both operands of a binary operation, borrowed where no Mython code can run before they
+        // are read. Only variables and constants are borrowed: if the rhs may call a method, the lhs
+        // is owned. An instance lhs makes the operation itself call a method, so then both are owned
+        class Operands {
+        public:
+            Operands(Statement& lhs, Statement& rhs, Closure& closure, Context& context)
+                : borrow_lhs_(!lhs.MayRunCode() && !rhs.MayRunCode())
+                , lhs_temp_(this->borrow_lhs_ ? ObjectHolder() : lhs.Execute(closure, context))
+                , lhs_(this->borrow_lhs_ ? &lhs.ExecuteBorrowed(closure, context, this->lhs_temp_) : &this->lhs_temp_)
+                , borrow_rhs_(!rhs.MayRunCode())
+                , rhs_temp_(this->borrow_rhs_ ? ObjectHolder() : rhs.Execute(closure, context))
+                , rhs_(this->borrow_rhs_ ? &rhs.ExecuteBorrowed(closure, context, this->rhs_temp_) : &this->rhs_temp_) {
+                if ((this->borrow_lhs_ || this->borrow_rhs_) && this->lhs_->TryAs<runtime::ClassInstance>() != nullptr) {
+                    this->lhs_temp_ = *this->lhs_;
+                    this->lhs_ = &this->lhs_temp_;
+                    this->rhs_temp_ = *this->rhs_;
+                    this->rhs_ = &this->rhs_temp_;
+                }
+            }
+
+            Operands(const Operands&) = delete;
+            Operands& operator=(const Operands&) = delete;
+
+            [[nodiscard]] const ObjectHolder& Lhs() const {
+                return *this->lhs_;
+            }
+
+            [[nodiscard]] const ObjectHolder& Rhs() const {
+                return *this->rhs_;
+            }
+        private:
+            const bool borrow_lhs_;
+            ObjectHolder lhs_temp_;
+            const ObjectHolder* lhs_;
+            const bool borrow_rhs_;
+            ObjectHolder rhs_temp_;
+            const ObjectHolder* rhs_;
+        };
+
+        // IsTrue runs no code, so a borrowed value is safe to test
+        bool IsTrue(Statement& statement, Closure& closure, Context& context) {
+            if (statement.MayRunCode()) {
+                return runtime::IsTrue(statement.Execute(closure, context));
+            }
+            ObjectHolder temp;
+            return runtime::IsTrue(statement.ExecuteBorrowed(closure, context, temp));
+        }
+    }  // namespace
 
     ObjectHolder Assignment::Execute(Closure& closure, Context& context) {
+        if (this->slot_) {
+            auto value = this->rv_->Execute(closure, context);
+            context.GetLocal(*this->slot_) = value;
+            return value;
+        }
         closure[this->var_] = this->rv_->Execute(closure, context);
         return closure.at(this->var_);
         throw std::runtime_error("Not in list");
     }
 
-    Assignment::Assignment(std::string var, std::unique_ptr<Statement> rv) : var_(std::move(var)), rv_(std::move(rv)) {}
+    Assignment::Assignment(runtime::Symbol var, std::unique_ptr<Statement> rv, std::optional<size_t> slot) : var_(var), rv_(std::move(rv)), slot_(slot) {}
+
+    VariableValue::VariableValue(runtime::Symbol var_name) {
+        this->ids_.emplace_back(var_name);
+    }
+
+    VariableValue::VariableValue(const std::vector<runtime::Symbol>& dotted_ids, std::optional<size_t> slot) : slot_(slot) {
+        for (auto id : dotted_ids) {
+            this->ids_.emplace_back(id);
+        }
+    }
 
-    VariableValue::VariableValue(const std::string& var_name) {
-        this->var_names_.push_back(var_name);
+    VariableValue::VariableValue(const std::vector<std::string>& dotted_ids)
+        : VariableValue(std::vector<runtime::Symbol>(dotted_ids.begin(), dotted_ids.end())) {
     }
 
-    VariableValue::VariableValue(std::vector<std::string> dotted_ids) {
-        this->var_names_ = dotted_ids;
+    ObjectHolder VariableValue::Execute(Closure& closure, Context& context) {
+        return this->Find(closure, context);
     }
 
-    ObjectHolder VariableValue::Execute(Closure& closure, [[maybe_unused]]Context& context) {
-        auto* cosulya = &closure;
-        for (size_t ptr = 0; ptr < this->var_names_.size(); ptr++) {
-            if (cosulya->count(this->var_names_[ptr]) == 1) {
-                if (ptr + 1 < this->var_names_.size()) {
-                    cosulya = &((*cosulya)[this->var_names_[ptr]].TryAs<runtime::ClassInstance>()->Fields());
+    const ObjectHolder& VariableValue::ExecuteBorrowed(Closure& closure, Context& context, [[maybe_unused]] ObjectHolder& temp) {
+        return this->Find(closure, context);
+    }
+
+    bool VariableValue::MayRunCode() const {
+        return false;
+    }
+
+    const ObjectHolder& VariableValue::Find(Closure& closure, Context& context) {
+        runtime::ClassInstance* instance = nullptr;
+        size_t ptr = 0;
+        if (this->slot_) {
+            const auto& local = context.GetLocal(*this->slot_);
+            if (!local) {
+                throw std::runtime_error("Not in list");
+            }
+            if (this->ids_.size() == 1) {
+                return *local;
+            }
+            instance = local->TryAs<runtime::ClassInstance>();
+            if (instance == nullptr) {
+                throw std::runtime_error("Not in list");
+            }
+            ptr = 1;
+        }
+        for (; ptr < this->ids_.size(); ptr++) {
+            ObjectHolder* value = nullptr;
+            if (instance != nullptr) {
+                value = this->ids_[ptr].Find(*instance);
+            } else if (auto it = closure.find(this->ids_[ptr].GetSymbol()); it != closure.end()) {
+                value = &it->second;
+            }
+            if (value != nullptr) {
+                if (ptr + 1 < this->ids_.size()) {
+                    instance = value->TryAs<runtime::ClassInstance>();
+                    if (instance == nullptr) {
+                        throw std::runtime_error("Not in list");
+                    }
                 } else {
-                    return (*cosulya)[this->var_names_[ptr]];
+                    return *value;
                 }
             }
         }
         throw std::runtime_error("Not in list");
     }
 
-    unique_ptr<Print> Print::Variable(const std::string& name) {
+    unique_ptr<Print> Print::Variable(runtime::Symbol name) {
         vector<unique_ptr<Statement>> args;
         args.push_back(std::make_unique<VariableValue>(name));
         return std::make_unique<Print>(std::move(args));
@@ -76,23 +173,23 @@ namespace ast {
         return {};
     }
 
-    MethodCall::MethodCall(std::unique_ptr<Statement> object, std::string method,
+    MethodCall::MethodCall(std::unique_ptr<Statement> object, runtime::Symbol method,
         std::vector<std::unique_ptr<Statement>> args)
-        : object_(std::move(object)), method_(std::move(method)), args_(std::move(args)) {
+        : object_(std::move(object)), cache_(method), args_(std::move(args)) {
     }
 
     ObjectHolder MethodCall::Execute(Closure& closure, Context& context) {
-        if (runtime::ClassInstance* instance = object_->Execute(closure, context).TryAs<runtime::ClassInstance>();
-            instance != nullptr) {
-            if (instance->HasMethod(method_, args_.size())) {
+        ObjectHolder object = object_->Execute(closure, context);
+        if (runtime::ClassInstance* instance = object.TryAs<runtime::ClassInstance>(); instance != nullptr) {
+            if (const auto* method = this->cache_.Lookup(instance->GetClass(), args_.size())) {
                 std::vector<ObjectHolder> actualArgs;
                 for (const auto& arg : args_) {
                     actualArgs.push_back(arg->Execute(closure, context));
                 }
-                return instance->Call(method_, actualArgs, context);
+                return instance->Call(*method, actualArgs, context);
             }
         }
-        throw std::runtime_error("Can not call method " + method_);
+        throw std::runtime_error("Can not call method " + this->cache_.GetName());
     }
 
     ObjectHolder Stringify::Execute(Closure& closure, Context& context) {
@@ -107,60 +204,36 @@ namespace ast {
     }
 
     ObjectHolder Add::Execute(Closure& closure, Context& context) {
-        auto lhs = std::move(BinaryOperation::lhs_)->Execute(closure, context);
-        auto rhs = std::move(BinaryOperation::rhs_)->Execute(closure, context);
-        if (lhs.TryAs<runtime::Number>() != nullptr && rhs.TryAs<runtime::Number>() != nullptr) {
-            return ObjectHolder::Own(runtime::Number(lhs.TryAs<runtime::Number>()->GetValue() + rhs.TryAs<runtime::Number>()->GetValue()));
-        } else if (lhs.TryAs<runtime::String>() != nullptr && rhs.TryAs<runtime::String>() != nullptr) {
-            return ObjectHolder::Own(runtime::String(lhs.TryAs<runtime::String>()->GetValue() + rhs.TryAs<runtime::String>()->GetValue()));
-        } else if (lhs.TryAs<runtime::ClassInstance>() != nullptr) {
-            if (lhs.TryAs<runtime::ClassInstance>()->HasMethod(ast::ADD_METHOD, 1)) {
-                return (lhs.TryAs<runtime::ClassInstance>()->Call(ast::ADD_METHOD, { rhs }, context));
-            }
-        }
-        throw runtime_error("Type add error");
+        Operands operands(*this->lhs_, *this->rhs_, closure, context);
+        return runtime::Add(operands.Lhs(), operands.Rhs(), context);
     }
 
     ObjectHolder Sub::Execute(Closure& closure, Context& context) {
-        auto lhs = std::move(BinaryOperation::lhs_)->Execute(closure, context);
-        auto rhs = std::move(BinaryOperation::rhs_)->Execute(closure, context);
-        if (lhs.TryAs<runtime::Number>() != nullptr && rhs.TryAs<runtime::Number>() != nullptr) {
-            return ObjectHolder::Own(runtime::Number(lhs.TryAs<runtime::Number>()->GetValue() - rhs.TryAs<runtime::Number>()->GetValue()));
-        }
-        throw runtime_error("Type sub error");
+        Operands operands(*this->lhs_, *this->rhs_, closure, context);
+        return runtime::Sub(operands.Lhs(), operands.Rhs(), context);
     }
 
     ObjectHolder Mult::Execute(Closure& closure, Context& context) {
-        auto lhs = std::move(BinaryOperation::lhs_)->Execute(closure, context);
-        auto rhs = std::move(BinaryOperation::rhs_)->Execute(closure, context);
-        if (lhs.TryAs<runtime::Number>() != nullptr && rhs.TryAs<runtime::Number>() != nullptr) {
-            return ObjectHolder::Own(runtime::Number(lhs.TryAs<runtime::Number>()->GetValue() * rhs.TryAs<runtime::Number>()->GetValue()));
-        }
-        throw runtime_error("Type multi error");
+        Operands operands(*this->lhs_, *this->rhs_, closure, context);
+        return runtime::Mult(operands.Lhs(), operands.Rhs(), context);
     }
 
     ObjectHolder Div::Execute(Closure& closure, Context& context) {
-        auto lhs = std::move(BinaryOperation::lhs_)->Execute(closure, context);
-        auto rhs = std::move(BinaryOperation::rhs_)->Execute(closure, context);
-        if (lhs.TryAs<runtime::Number>() != nullptr && rhs.TryAs<runtime::Number>() != nullptr) {
-            if (rhs.TryAs<runtime::Number>()->GetValue() == 0) {
-                throw runtime_error("Divided by zero");
-            }
-            return ObjectHolder::Own(runtime::Number(lhs.TryAs<runtime::Number>()->GetValue() / rhs.TryAs<runtime::Number>()->GetValue()));
-        }
-        throw runtime_error("Type sun error");
+        Operands operands(*this->lhs_, *this->rhs_, closure, context);
+        return runtime::Div(operands.Lhs(), operands.Rhs(), context);
     }
 
     ObjectHolder Compound::Execute(Closure& closure, Context& context) {
-        for (size_t ptr = 0; ptr < this->args_.size(); ptr++) {
+        for (size_t ptr = 0; ptr < this->args_.size() && !context.IsReturning(); ptr++) {
             this->args_[ptr]->Execute(closure, context);
         }
         return ObjectHolder::None();
     }
 
     ObjectHolder Return::Execute(Closure& closure, Context& context) {
-        auto rnrned = this->st_->Execute(closure, context);;
-        throw ObjRet(rnrned);
+        auto rnrned = this->st_->Execute(closure, context);
+        context.SetReturnValue(rnrned);
+        return rnrned;
     }
 
     ClassDefinition::ClassDefinition(ObjectHolder cls) : cls_(std::move(cls)) {}
@@ -171,21 +244,20 @@ namespace ast {
         return closure[cls_.TryAs<runtime::Class>()->GetName()];
     }
 
-    FieldAssignment::FieldAssignment(VariableValue object, std::string field_name, std::unique_ptr<Statement> rv) : str_name_(std::move(field_name)), obj_(std::move(object)), rv_(std::move(rv)) {}
+    FieldAssignment::FieldAssignment(VariableValue object, runtime::Symbol field_name, std::unique_ptr<Statement> rv) : field_(field_name), obj_(std::move(object)), rv_(std::move(rv)) {}
 
     ObjectHolder FieldAssignment::Execute(Closure& closure, Context& context) {
         ObjectHolder tmp = this->obj_.Execute(closure, context);
         if (!tmp.TryAs<runtime::ClassInstance>()) {
             throw std::runtime_error("Some data error");
         }
-        tmp.TryAs<runtime::ClassInstance>()->Fields()[this->str_name_] = this->rv_->Execute(closure, context);
-        return  tmp.TryAs<runtime::ClassInstance>()->Fields().at(this->str_name_);
+        return this->field_.Assign(*tmp.TryAs<runtime::ClassInstance>(), this->rv_->Execute(closure, context));
     }
 
     IfElse::IfElse(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> ifBody, std::unique_ptr<Statement> elseBody) : cond_(std::move(condition)), ifb_(std::move(ifBody)), elseb_(std::move(elseBody)) {}
 
     ObjectHolder IfElse::Execute(Closure& closure, Context& context) {
-        if (runtime::IsTrue(this->cond_->Execute(closure, context))) {
+        if (IsTrue(*this->cond_, closure, context)) {
             return this->ifb_->Execute(closure, context);
         } else {
             if (this->elseb_) {
@@ -195,37 +267,29 @@ namespace ast {
         return ObjectHolder::None();
     }
 
+    // Both operands are evaluated, as before
     ObjectHolder Or::Execute(Closure& closure, Context& context) {
-        auto lhs = (BinaryOperation::lhs_)->Execute(closure, context);
-        auto rhs = (BinaryOperation::rhs_)->Execute(closure, context);
-        if (!runtime::IsTrue(lhs)) {
-            return ObjectHolder::Own(runtime::Bool(runtime::IsTrue(rhs)));
-        }
-        return ObjectHolder::Own(runtime::Bool(true));
-        throw runtime_error("Type or error");
+        const bool lhs = IsTrue(*this->lhs_, closure, context);
+        const bool rhs = IsTrue(*this->rhs_, closure, context);
+        return ObjectHolder::Own(runtime::Bool(lhs || rhs));
     }
 
     ObjectHolder And::Execute(Closure& closure, Context& context) {
-        auto lhs = (BinaryOperation::lhs_)->Execute(closure, context);
-        auto rhs = (BinaryOperation::rhs_)->Execute(closure, context);
-        if (runtime::IsTrue(lhs)) {
-            return ObjectHolder::Own(runtime::Bool(runtime::IsTrue(rhs)));
-        }
-        return ObjectHolder::Own(runtime::Bool(false));
-        throw runtime_error("Type and error");
+        const bool lhs = IsTrue(*this->lhs_, closure, context);
+        const bool rhs = IsTrue(*this->rhs_, closure, context);
+        return ObjectHolder::Own(runtime::Bool(lhs && rhs));
     }
 
     ObjectHolder Not::Execute(Closure& closure, Context& context) {
-        auto lhs = (UnaryOperation::arg_)->Execute(closure, context);
-        return ObjectHolder::Own(runtime::Bool(!runtime::IsTrue(lhs)));
+        return ObjectHolder::Own(runtime::Bool(!IsTrue(*this->arg_, closure, context)));
     }
 
     Comparison::Comparison(Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Statement> rhs) : BinaryOperation(std::move(lhs), std::move(rhs)), cmp_(cmp) {
     }
 
     ObjectHolder Comparison::Execute(Closure& closure, Context& context) {
-        bool result = cmp_(this->lhs_->Execute(closure, context), this->rhs_->Execute(closure, context), context);
-        return ObjectHolder::Own(runtime::Bool(result));
+        Operands operands(*this->lhs_, *this->rhs_, closure, context);
+        return ObjectHolder::Own(runtime::Bool(this->cmp_(operands.Lhs(), operands.Rhs(), context)));
     }
 
     NewInstance::NewInstance(const runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args) : cls_(class_), args_(std::move(args)) {}
@@ -249,12 +313,264 @@ namespace ast {
     MethodBody::MethodBody(std::unique_ptr<Statement>&& body) : body_(std::move(body)) {}
 
     ObjectHolder MethodBody::Execute(Closure& closure, Context& context) {
-        try {
-            auto a = this->body_->Execute(closure, context);
-        } catch (ObjRet& e) {
-            return e.Get_ObjHldr();
+        this->body_->Execute(closure, context);
+        if (context.IsReturning()) {
+            return context.TakeReturnValue();
         }
         return ObjectHolder::None();
     }
 
-}  // namespace ast
\ No newline at end of file
+    template <>
+    void NumericConst::Compile(bytecode::Compiler& compiler) {
+        compiler.Emit(bytecode::OpCode::LoadConst, compiler.AddConstant(this->GetValue().GetValue()));
+    }
+
+    template <>
+    void StringConst::Compile(bytecode::Compiler& compiler) {
+        compiler.Emit(bytecode::OpCode::LoadConst, compiler.AddConstant(this->GetValue().GetValue()));
+    }
+
+    template <>
+    void BoolConst::Compile(bytecode::Compiler& compiler) {
+        compiler.Emit(bytecode::OpCode::LoadConst, compiler.AddConstant(this->GetValue().GetValue()));
+    }
+
+    void VariableValue::Compile(bytecode::Compiler& compiler) {
+        if (this->slot_) {
+            compiler.Emit(bytecode::OpCode::LoadLocal, static_cast<uint32_t>(*this->slot_));
+        } else {
+            compiler.Emit(bytecode::OpCode::LoadVar, compiler.AddName(this->ids_.front().GetSymbol()));
+        }
+        for (size_t ptr = 1; ptr < this->ids_.size(); ptr++) {
+            compiler.Emit(bytecode::OpCode::LoadField, compiler.AddName(this->ids_[ptr].GetSymbol()));
+        }
+    }
+
+    void Assignment::Compile(bytecode::Compiler& compiler) {
+        this->rv_->Compile(compiler);
+        if (this->slot_) {
+            compiler.Emit(bytecode::OpCode::StoreLocal, static_cast<uint32_t>(*this->slot_));
+        } else {
+            compiler.Emit(bytecode::OpCode::StoreVar, compiler.AddName(this->var_));
+        }
+    }
+
+    void FieldAssignment::Compile(bytecode::Compiler& compiler) {
+        this->obj_.Compile(compiler);
+        this->rv_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::StoreField, compiler.AddName(this->field_.GetSymbol()));
+    }
+
+    void None::Compile(bytecode::Compiler& compiler) {
+        compiler.Emit(bytecode::OpCode::LoadNone);
+    }
+
+    void Print::Compile(bytecode::Compiler& compiler) {
+        for (const auto& arg : this->args_) {
+            arg->Compile(compiler);
+        }
+        compiler.Emit(bytecode::OpCode::Print, 0, this->args_.size());
+    }
+
+    void MethodCall::Compile(bytecode::Compiler& compiler) {
+        this->object_->Compile(compiler);
+        for (const auto& arg : this->args_) {
+            arg->Compile(compiler);
+        }
+        compiler.Emit(bytecode::OpCode::CallMethod, compiler.AddName(this->cache_.GetSymbol()), this->args_.size());
+    }
+
+    void NewInstance::Compile(bytecode::Compiler& compiler) {
+        const auto cls = compiler.AddClass(this->cls_);
+        // Arguments are evaluated only when there is a matching __init__, as in Execute
+        const auto* init = this->cls_.GetMethod(INIT_METHOD);
+        if (init == nullptr || init->formal_params.size() != this->args_.size()) {
+            compiler.Emit(bytecode::OpCode::NewInstance, cls);
+            return;
+        }
+        for (const auto& arg : this->args_) {
+            arg->Compile(compiler);
+        }
+        compiler.Emit(bytecode::OpCode::NewInstance, cls, this->args_.size());
+    }
+
+    void Stringify::Compile(bytecode::Compiler& compiler) {
+        this->arg_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::Stringify);
+    }
+
+    void Add::Compile(bytecode::Compiler& compiler) {
+        this->lhs_->Compile(compiler);
+        this->rhs_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::Add);
+    }
+
+    void Sub::Compile(bytecode::Compiler& compiler) {
+        this->lhs_->Compile(compiler);
+        this->rhs_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::Sub);
+    }
+
+    void Mult::Compile(bytecode::Compiler& compiler) {
+        this->lhs_->Compile(compiler);
+        this->rhs_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::Mult);
+    }
+
+    void Div::Compile(bytecode::Compiler& compiler) {
+        this->lhs_->Compile(compiler);
+        this->rhs_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::Div);
+    }
+
+    void Or::Compile(bytecode::Compiler& compiler) {
+        this->lhs_->Compile(compiler);
+        this->rhs_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::Or);
+    }
+
+    void And::Compile(bytecode::Compiler& compiler) {
+        this->lhs_->Compile(compiler);
+        this->rhs_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::And);
+    }
+
+    void Not::Compile(bytecode::Compiler& compiler) {
+        this->arg_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::Not);
+    }
+
+    void Compound::Compile(bytecode::Compiler& compiler) {
+        for (const auto& stmt : this->args_) {
+            stmt->Compile(compiler);
+            compiler.Emit(bytecode::OpCode::Pop);
+        }
+        compiler.Emit(bytecode::OpCode::LoadNone);
+    }
+
+    void MethodBody::Compile(bytecode::Compiler& compiler) {
+        this->body_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::Pop);
+        compiler.Emit(bytecode::OpCode::LoadNone);
+        compiler.Emit(bytecode::OpCode::Return);
+    }
+
+    void Return::Compile(bytecode::Compiler& compiler) {
+        this->st_->Compile(compiler);
+        compiler.Emit(bytecode::OpCode::Return);
+    }
+
+    void ClassDefinition::Compile(bytecode::Compiler& compiler) {
+        compiler.Emit(bytecode::OpCode::DefineClass, compiler.AddClass(*this->cls_.TryAs<runtime::Class>()));
+    }
+
+    void IfElse::Compile(bytecode::Compiler& compiler) {
+        this->cond_->Compile(compiler);
+        const auto to_else = compiler.Emit(bytecode::OpCode::JumpIfFalse);
+        this->ifb_->Compile(compiler);
+        const auto to_end = compiler.Emit(bytecode::OpCode::Jump);
+        compiler.PatchJump(to_else);
+        if (this->elseb_) {
+            this->elseb_->Compile(compiler);
+        } else {
+            compiler.Emit(bytecode::OpCode::LoadNone);
+        }
+        compiler.PatchJump(to_end);
+    }
+
+    void Comparison::Compile(bytecode::Compiler& compiler) {
+        using Fn = bool (*)(const runtime::ObjectHolder&, const runtime::ObjectHolder&, runtime::Context&);
+        static const std::pair<Fn, bytecode::OpCode> comparators[] = {
+            { runtime::Equal, bytecode::OpCode::Equal },
+            { runtime::NotEqual, bytecode::OpCode::NotEqual },
+            { runtime::Less, bytecode::OpCode::Less },
+            { runtime::Greater, bytecode::OpCode::Greater },
+            { runtime::LessOrEqual, bytecode::OpCode::LessOrEqual },
+            { runtime::GreaterOrEqual, bytecode::OpCode::GreaterOrEqual },
+        };
+        // Only the runtime comparators have opcodes, custom ones stay with the tree-walker
+        if (const auto* fn = this->cmp_.target<Fn>(); fn != nullptr) {
+            for (const auto& [cmp, op] : comparators) {
+                if (*fn == cmp) {
+                    this->lhs_->Compile(compiler);
+                    this->rhs_->Compile(compiler);
+                    compiler.Emit(op);
+                    return;
+                }
+            }
+        }
+        compiler.EmitFallback(*this);
+    }
+
+    template <>
+    uint32_t NumericConst::Flatten(FlatBuilder& builder) {
+        return builder.AddConstant(this->value_);
+    }
+
+    template <>
+    uint32_t StringConst::Flatten(FlatBuilder& builder) {
+        return builder.AddConstant(this->value_);
+    }
+
+    template <>
+    uint32_t BoolConst::Flatten(FlatBuilder& builder) {
+        return builder.AddConstant(this->value_);
+    }
+
+    uint32_t VariableValue::Flatten(FlatBuilder& builder) {
+        if (this->ids_.size() > 1) {
+            return builder.AddLeaf(*this);
+        }
+        if (this->slot_) {
+            return builder.AddLocal(*this->slot_);
+        }
+        return builder.AddVariable(this->ids_.front().GetSymbol());
+    }
+
+    uint32_t Add::Flatten(FlatBuilder& builder) {
+        const uint32_t lhs = this->lhs_->Flatten(builder);
+        const uint32_t rhs = this->rhs_->Flatten(builder);
+        return builder.AddOperation(FlatOp::Add, lhs, rhs);
+    }
+
+    uint32_t Sub::Flatten(FlatBuilder& builder) {
+        const uint32_t lhs = this->lhs_->Flatten(builder);
+        const uint32_t rhs = this->rhs_->Flatten(builder);
+        return builder.AddOperation(FlatOp::Sub, lhs, rhs);
+    }
+
+    uint32_t Mult::Flatten(FlatBuilder& builder) {
+        const uint32_t lhs = this->lhs_->Flatten(builder);
+        const uint32_t rhs = this->rhs_->Flatten(builder);
+        return builder.AddOperation(FlatOp::Mult, lhs, rhs);
+    }
+
+    uint32_t Div::Flatten(FlatBuilder& builder) {
+        const uint32_t lhs = this->lhs_->Flatten(builder);
+        const uint32_t rhs = this->rhs_->Flatten(builder);
+        return builder.AddOperation(FlatOp::Div, lhs, rhs);
+    }
+
+    uint32_t Or::Flatten(FlatBuilder& builder) {
+        const uint32_t lhs = this->lhs_->Flatten(builder);
+        const uint32_t rhs = this->rhs_->Flatten(builder);
+        return builder.AddOperation(FlatOp::Or, lhs, rhs);
+    }
+
+    uint32_t And::Flatten(FlatBuilder& builder) {
+        const uint32_t lhs = this->lhs_->Flatten(builder);
+        const uint32_t rhs = this->rhs_->Flatten(builder);
+        return builder.AddOperation(FlatOp::And, lhs, rhs);
+    }
+
+    uint32_t Not::Flatten(FlatBuilder& builder) {
+        return builder.AddOperation(FlatOp::Not, this->arg_->Flatten(builder));
+    }
+
+    uint32_t Comparison::Flatten(FlatBuilder& builder) {
+        const uint32_t lhs = this->lhs_->Flatten(builder);
+        const uint32_t rhs = this->rhs_->Flatten(builder);
+        return builder.AddComparison(this->cmp_, lhs, rhs);
+    }
+
+}  // namespace ast
@@ -3,7 +3,7 @@
 #include "runtime.h"
 #include <utility>
 #include <functional>
-#include <exception>
+#include <optional>
 
 namespace ast {
 
@@ -12,58 +12,103 @@ namespace ast {
     template <typename T>
     class ValueStatement : public Statement {
     public:
-        explicit ValueStatement(T v) : value_(std::move(v)) {}
+        explicit ValueStatement(T v) : value_(runtime::ObjectHolder::Own(std::move(v))) {}
 
+        // The holder is built once, a copy of it is inline for Number and Bool and a reference count for String
         runtime::ObjectHolder Execute([[maybe_unused]] runtime::Closure& closure, [[maybe_unused]] runtime::Context& context) override {
-            return runtime::ObjectHolder::Share(value_);
+            return value_;
+        }
+
+        const runtime::ObjectHolder& ExecuteBorrowed([[maybe_unused]] runtime::Closure& closure, [[maybe_unused]] runtime::Context& context,
+            [[maybe_unused]] runtime::ObjectHolder& temp) override {
+            return value_;
+        }
+
+        [[nodiscard]] bool MayRunCode() const override {
+            return false;
+        }
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
+
+        [[nodiscard]] const T& GetValue() const {
+            return *value_.template TryAs<T>();
         }
     private:
-        T value_;
+        runtime::ObjectHolder value_;
     };
 
     using NumericConst = ValueStatement<runtime::Number>;
     using StringConst = ValueStatement<runtime::String>;
     using BoolConst = ValueStatement<runtime::Bool>;
 
-    struct ObjRet : public std::runtime_error {
-    public:
-        ObjRet(runtime::ObjectHolder obj) : std::runtime_error::runtime_error(std::string()), ObjHldr_(obj) {}
+    template <>
+    void NumericConst::Compile(bytecode::Compiler& compiler);
 
-        runtime::ObjectHolder Get_ObjHldr() {
-            return this->ObjHldr_;
-        }
-    private:
-        runtime::ObjectHolder ObjHldr_;
-    };
+    template <>
+    uint32_t NumericConst::Flatten(FlatBuilder& builder);
+
+    template <>
+    void StringConst::Compile(bytecode::Compiler& compiler);
+
+    template <>
+    uint32_t StringConst::Flatten(FlatBuilder& builder);
+
+    template <>
+    void BoolConst::Compile(bytecode::Compiler& compiler);
+
+    template <>
+    uint32_t BoolConst::Flatten(FlatBuilder& builder);
 
     class VariableValue : public Statement {
     public:
-        explicit VariableValue(const std::string& var_name);
+        explicit VariableValue(runtime::Symbol var_name);
 
-        explicit VariableValue(std::vector<std::string> dotted_ids);
+        // slot is the frame slot of the first name when the parser resolved it as a local
+        explicit VariableValue(const std::vector<runtime::Symbol>& dotted_ids, std::optional<size_t> slot = std::nullopt);
+        explicit VariableValue(const std::vector<std::string>& dotted_ids);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        const runtime::ObjectHolder& ExecuteBorrowed(runtime::Closure& closure, runtime::Context& context, runtime::ObjectHolder& temp) override;
+
+        [[nodiscard]] bool MayRunCode() const override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
     private:
-        std::vector<std::string> var_names_;
+        // The holder of the value in the Closure, the frame or the field
+        const runtime::ObjectHolder& Find(runtime::Closure& closure, runtime::Context& context);
+
+        // Every name caches its field index for when it is looked up in an instance
+        std::vector<runtime::FieldCache> ids_;
+        std::optional<size_t> slot_;
     };
 
     class Assignment : public Statement {
     public:
-        Assignment(std::string var, std::unique_ptr<Statement> rv);
+        Assignment(runtime::Symbol var, std::unique_ptr<Statement> rv, std::optional<size_t> slot = std::nullopt);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
-        std::string var_;
+        runtime::Symbol var_;
         std::unique_ptr<Statement> rv_;
+        std::optional<size_t> slot_;
     };
 
     class FieldAssignment : public Statement {
     public:
-        FieldAssignment(VariableValue object, std::string field_name, std::unique_ptr<Statement> rv);
+        FieldAssignment(VariableValue object, runtime::Symbol field_name, std::unique_ptr<Statement> rv);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
-        std::string str_name_;
+        runtime::FieldCache field_;
         VariableValue obj_;
         std::unique_ptr<Statement> rv_;
     };
@@ -74,6 +119,8 @@ namespace ast {
             [[maybe_unused]] runtime::Context& context) override {
             return {};
         }
+
+        void Compile(bytecode::Compiler& compiler) override;
     };
 
     class Print : public Statement {
@@ -82,21 +129,25 @@ namespace ast {
 
         explicit Print(std::vector<std::unique_ptr<Statement>> args);
 
-        static std::unique_ptr<Print> Variable(const std::string& name);
+        static std::unique_ptr<Print> Variable(runtime::Symbol name);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
         std::vector<std::unique_ptr<Statement>> args_;
     };
 
     class MethodCall : public Statement {
     public:
-        MethodCall(std::unique_ptr<Statement> object, std::string method, std::vector<std::unique_ptr<Statement>> args);
+        MethodCall(std::unique_ptr<Statement> object, runtime::Symbol method, std::vector<std::unique_ptr<Statement>> args);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
         std::unique_ptr<Statement> object_;
-        std::string method_;
+        runtime::CallSiteCache cache_;
         std::vector<std::unique_ptr<Statement>> args_;
     };
 
@@ -107,6 +158,8 @@ namespace ast {
         NewInstance(const runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
         const runtime::Class& cls_;
         std::vector<std::unique_ptr<Statement>> args_;
@@ -123,6 +176,8 @@ namespace ast {
         using UnaryOperation::UnaryOperation;
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     };
 
     class BinaryOperation : public Statement {
@@ -137,6 +192,10 @@ namespace ast {
         using BinaryOperation::BinaryOperation;
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
     };
 
     class Sub : public BinaryOperation {
@@ -144,6 +203,10 @@ namespace ast {
         using BinaryOperation::BinaryOperation;
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
     };
 
     class Mult : public BinaryOperation {
@@ -151,6 +214,10 @@ namespace ast {
         using BinaryOperation::BinaryOperation;
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
     };
 
     class Div : public BinaryOperation {
@@ -158,6 +225,10 @@ namespace ast {
         using BinaryOperation::BinaryOperation;
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
     };
 
     class Or : public BinaryOperation {
@@ -165,6 +236,10 @@ namespace ast {
         using BinaryOperation::BinaryOperation;
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
     };
 
     class And : public BinaryOperation {
@@ -172,6 +247,10 @@ namespace ast {
         using BinaryOperation::BinaryOperation;
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
     };
 
     class Not : public UnaryOperation {
@@ -179,6 +258,10 @@ namespace ast {
         using UnaryOperation::UnaryOperation;
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
     };
 
     class Compound : public Statement {
@@ -193,6 +276,8 @@ namespace ast {
         }
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
         std::vector<std::unique_ptr<Statement>> args_;
     };
@@ -202,6 +287,8 @@ namespace ast {
         explicit MethodBody(std::unique_ptr<Statement>&& body);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
         std::unique_ptr<Statement> body_;
     };
@@ -211,6 +298,8 @@ namespace ast {
         explicit Return(std::unique_ptr<Statement> statement) : st_(std::move(statement)) {}
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
         std::unique_ptr<Statement> st_;
     };
@@ -220,6 +309,8 @@ namespace ast {
         explicit ClassDefinition(runtime::ObjectHolder cls);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
         runtime::ObjectHolder cls_;
     };
@@ -229,6 +320,8 @@ namespace ast {
         IfElse(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> ifBody, std::unique_ptr<Statement> elseBody);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
     private:
         std::unique_ptr<Statement> cond_;
         std::unique_ptr<Statement> ifb_;
@@ -241,7 +334,15 @@ namespace ast {
 
         Comparison(Comparator cmp, std::unique_ptr<Statement> lhs, std::unique_ptr<Statement> rhs);
 
+        [[nodiscard]] const Comparator& GetComparator() const {
+            return this->cmp_;
+        }
+
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        void Compile(bytecode::Compiler& compiler) override;
+
+        uint32_t Flatten(FlatBuilder& builder) override;
     private:
         Comparator cmp_;
     };
@@ -1,3 +1,4 @@
+#include "flat.h"
 #include "statement.h"
 #include "test_runner_p.h"
 
@@ -65,6 +66,50 @@ namespace ast {
             ASSERT(context.output.str().empty());
         }
 
+        void TestConstantHolders() {
+            runtime::DummyContext context;
+            Closure empty;
+
+            ObjectHolder text;
+            {
+                StringConst value(runtime::String("shared"s));
+                text = value.Execute(empty, context);
+                ASSERT_EQUAL(value.Execute(empty, context).Get(), text.Get());
+                ASSERT_EQUAL(&value.GetValue(), text.TryAs<runtime::String>());
+            }
+            // The value belongs to the holder, not to the node
+            ASSERT_EQUAL(text.TryAs<runtime::String>()->GetValue(), "shared"s);
+
+            NumericConst num(runtime::Number(7));
+            BoolConst flag(runtime::Bool(false));
+            ASSERT_EQUAL(num.Execute(empty, context).TryAs<runtime::Number>()->GetValue(), 7);
+            ASSERT_EQUAL(num.GetValue().GetValue(), 7);
+            ASSERT(!runtime::IsTrue(flag.Execute(empty, context)));
+        }
+
+        void TestBorrowedValues() {
+            runtime::DummyContext context;
+            Closure closure;
+            closure["s"s] = ObjectHolder::Own(runtime::String("text"s));
+            ObjectHolder temp;
+
+            VariableValue var("s"s);
+            ASSERT(!var.MayRunCode());
+            ASSERT_EQUAL(&var.ExecuteBorrowed(closure, context, temp), &closure.at("s"s));
+            ASSERT(!temp);
+
+            StringConst text(runtime::String("text"s));
+            ASSERT(!text.MayRunCode());
+            ASSERT_EQUAL(&text.ExecuteBorrowed(closure, context, temp), &text.ExecuteBorrowed(closure, context, temp));
+            ASSERT(!temp);
+
+            // Other nodes hand over their result through temp
+            Add sum(make_unique<VariableValue>("s"s), make_unique<StringConst>(runtime::String("!"s)));
+            ASSERT(sum.MayRunCode());
+            ASSERT_EQUAL(&sum.ExecuteBorrowed(closure, context, temp), &temp);
+            ASSERT_EQUAL(temp.TryAs<runtime::String>()->GetValue(), "text!"s);
+        }
+
         void TestVariable() {
             runtime::DummyContext context;
 
@@ -453,11 +498,118 @@ namespace ast {
             test_not(false);
         }
 
+        void TestReturn() {
+            runtime::DummyContext context;
+
+            MethodBody body(make_unique<Compound>(
+                make_unique<Assignment>("x"s, make_unique<NumericConst>(1)),
+                make_unique<IfElse>(make_unique<BoolConst>(true),
+                    make_unique<Compound>(make_unique<Return>(make_unique<VariableValue>("x"s))), nullptr),
+                make_unique<Assignment>("x"s, make_unique<NumericConst>(2))));
+
+            Closure closure;
+            ASSERT_OBJECT_VALUE_EQUAL(body.Execute(closure, context), 1);
+            ASSERT_OBJECT_VALUE_EQUAL(closure.at("x"s), 1);
+            ASSERT(!context.IsReturning());
+
+            MethodBody empty(make_unique<Compound>());
+            ASSERT(!empty.Execute(closure, context));
+        }
+
+        // A method body built without a MethodBody must not leave the signal behind its call
+        void TestReturnFromBareBody() {
+            runtime::DummyContext context;
+
+            vector<runtime::Method> methods;
+            methods.push_back({ "get"s, {}, make_unique<Compound>(make_unique<Return>(make_unique<NumericConst>(5))) });
+            runtime::Class cls("Box"s, std::move(methods), nullptr);
+            runtime::ClassInstance box(cls);
+
+            ASSERT_OBJECT_VALUE_EQUAL(box.Call("get"s, {}, context), 5);
+            ASSERT(!context.IsReturning());
+
+            Closure closure;
+            Compound(make_unique<Print>(make_unique<StringConst>("after"s))).Execute(closure, context);
+            ASSERT_EQUAL(context.output.str(), "after\n"s);
+        }
+
+        void TestFlatExpression() {
+            // (x * 3 + 7) / 2 - x < x and not x == 4
+            auto make = [] {
+                auto var = [] {
+                    return make_unique<VariableValue>("x"s);
+                };
+                return make_unique<And>(
+                    make_unique<Comparison>(runtime::Less,
+                        make_unique<Sub>(
+                            make_unique<Div>(
+                                make_unique<Add>(make_unique<Mult>(var(), make_unique<NumericConst>(3)), make_unique<NumericConst>(7)),
+                                make_unique<NumericConst>(2)),
+                            var()),
+                        var()),
+                    make_unique<Not>(make_unique<Comparison>(runtime::Equal, var(), make_unique<NumericConst>(4))));
+            };
+            auto tree = make();
+            FlatExpression flat(make());
+
+            const auto& nodes = flat.GetNodes();
+            ASSERT_EQUAL(nodes.size(), 16U);
+            for (size_t index = 0; index < nodes.size(); index++) {
+                ASSERT(nodes[index].lhs <= index && nodes[index].rhs <= index);
+            }
+
+            runtime::DummyContext context;
+            Closure closure;
+            for (int x = -10; x <= 10; x++) {
+                closure["x"s] = ObjectHolder::Own(runtime::Number(x));
+                ASSERT_EQUAL(runtime::IsTrue(flat.Execute(closure, context)), runtime::IsTrue(tree->Execute(closure, context)));
+            }
+
+            // A failed evaluation leaves the expression usable
+            FlatExpression division(make_unique<Sub>(make_unique<NumericConst>(10),
+                make_unique<Div>(make_unique<NumericConst>(1), make_unique<VariableValue>("x"s))));
+            closure["x"s] = ObjectHolder::Own(runtime::Number(0));
+            ASSERT_THROWS(division.Execute(closure, context), std::runtime_error);
+            closure["x"s] = ObjectHolder::Own(runtime::Number(1));
+            ASSERT_OBJECT_VALUE_EQUAL(division.Execute(closure, context), 9);
+
+            // A single operator is left to the tree-walker
+            auto small = FlatExpression::Flatten(make_unique<Add>(make_unique<NumericConst>(1), make_unique<NumericConst>(2)));
+            ASSERT(dynamic_cast<FlatExpression*>(small.get()) == nullptr);
+        }
+
+        void TestFlatExpressionRecursion() {
+            // def down(n):
+            //   if n > 0:
+            //     return self.down(n - 1) * 1 + n
+            //   return 0
+            vector<unique_ptr<Statement>> args;
+            args.push_back(make_unique<Sub>(make_unique<VariableValue>("n"s), make_unique<NumericConst>(1)));
+            auto call = make_unique<MethodCall>(make_unique<VariableValue>("self"s), "down"s, std::move(args));
+            auto sum = make_unique<FlatExpression>(make_unique<Add>(
+                make_unique<Mult>(std::move(call), make_unique<NumericConst>(1)), make_unique<VariableValue>("n"s)));
+            auto body = make_unique<Compound>(
+                make_unique<IfElse>(
+                    make_unique<Comparison>(runtime::Greater, make_unique<VariableValue>("n"s), make_unique<NumericConst>(0)),
+                    make_unique<Compound>(make_unique<Return>(std::move(sum))), nullptr),
+                make_unique<Return>(make_unique<NumericConst>(0)));
+
+            vector<runtime::Method> methods;
+            methods.push_back({ "down"s, { "n"s }, make_unique<MethodBody>(std::move(body)) });
+            runtime::Class cls("Down"s, std::move(methods), nullptr);
+
+            runtime::DummyContext context;
+            runtime::ClassInstance instance(cls);
+            ASSERT_OBJECT_VALUE_EQUAL(instance.Call("down"s, { ObjectHolder::Own(runtime::Number(4)) }, context), 10);
+        }
+
     }  // namespace
 
     void RunUnitTests(TestRunner& tr) {
         RUN_TEST(tr, ast::TestNumericConst);
         RUN_TEST(tr, ast::TestStringConst);
+        RUN_TEST(tr, ast::TestConstantHolders);
+        RUN_TEST(tr, ast::TestBorrowedValues);
         RUN_TEST(tr, ast::TestVariable);
         RUN_TEST(tr, ast::TestAssignment);
         RUN_TEST(tr, ast::TestFieldAssignment);
@@ -476,6 +628,10 @@ namespace ast {
         RUN_TEST(tr, ast::TestOr);
         RUN_TEST(tr, ast::TestAnd);
         RUN_TEST(tr, ast::TestNot);
+        RUN_TEST(tr, ast::TestReturn);
+        RUN_TEST(tr, ast::TestReturnFromBareBody);
+        RUN_TEST(tr, ast::TestFlatExpression);
+        RUN_TEST(tr, ast::TestFlatExpressionRecursion);
     }
 
 }  // namespace ast
\ No newline at end of file
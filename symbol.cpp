@@ -0,0 +1,66 @@
+#include "symbol.h"
+
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+        // Names are never removed, so the pointers handed out stay valid
+        class SymbolTable {
+        public:
+            const string* Intern(string_view name) {
+                lock_guard<mutex> lock(this->mutex_);
+                auto it = this->index_.find(name);
+                if (it != this->index_.end()) {
+                    return it->second;
+                }
+                const string* result = &this->names_.emplace_back(name);
+                this->index_.emplace(*result, result);
+                return result;
+            }
+
+            size_t Count() {
+                lock_guard<mutex> lock(this->mutex_);
+                return this->names_.size();
+            }
+        private:
+            mutex mutex_;
+            deque<string> names_;
+            unordered_map<string_view, const string*> index_;
+        };
+
+        SymbolTable& GetTable() {
+            static SymbolTable table;
+            return table;
+        }
+
+        // Direct-mapped per-thread cache of recently interned names, so the lexer takes the
+        // lock of the table only for names it has not seen lately
+        constexpr size_t RECENT_SIZE = 1024;
+        thread_local const string* recent[RECENT_SIZE];
+    }  // namespace
+
+    Symbol::Symbol() : Symbol(string_view()) {}
+
+    Symbol::Symbol(string_view name) {
+        const string*& slot = recent[hash<string_view>()(name) % RECENT_SIZE];
+        if (slot == nullptr || *slot != name) {
+            slot = GetTable().Intern(name);
+        }
+        this->name_ = slot;
+    }
+
+    size_t Symbol::Count() {
+        return GetTable().Count();
+    }
+
+    ostream& operator<<(ostream& os, Symbol symbol) {
+        return os << symbol.GetName();
+    }
+
+}  // namespace runtime
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+namespace runtime {
+
+    // Interned identifier. Equal names share one Symbol for the lifetime of the process, so
+    // comparing and hashing a Symbol is a pointer operation. Interning is thread-safe
+    class Symbol {
+    public:
+        // The empty name
+        Symbol();
+
+        Symbol(std::string_view name);
+
+        Symbol(const std::string& name) : Symbol(std::string_view(name)) {}
+
+        Symbol(const char* name) : Symbol(std::string_view(name)) {}
+
+        [[nodiscard]] const std::string& GetName() const {
+            return *this->name_;
+        }
+
+        [[nodiscard]] const void* GetId() const {
+            return this->name_;
+        }
+
+        // Number of distinct names interned so far
+        [[nodiscard]] static size_t Count();
+
+        friend bool operator==(Symbol lhs, Symbol rhs) {
+            return lhs.name_ == rhs.name_;
+        }
+
+        friend bool operator!=(Symbol lhs, Symbol rhs) {
+            return lhs.name_ != rhs.name_;
+        }
+    private:
+        const std::string* name_;
+    };
+
+    std::ostream& operator<<(std::ostream& os, Symbol symbol);
+
+}  // namespace runtime
+
+namespace std {
+    template <>
+    struct hash<runtime::Symbol> {
+        size_t operator()(runtime::Symbol symbol) const {
+            return hash<const void*>()(symbol.GetId());
+        }
+    };
+}  // namespace std
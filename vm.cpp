@@ -0,0 +1,294 @@
+#include "vm.h"
+
+#include <sstream>
+
+using namespace std;
+
+namespace bytecode {
+
+    using runtime::Closure;
+    using runtime::Context;
+    using runtime::ObjectHolder;
+
+    namespace {
+        const runtime::Symbol INIT_METHOD = "__init__";
+
+        // Drops whatever a chunk left on the stack, also when it is left by an exception
+        class StackGuard {
+        public:
+            explicit StackGuard(std::vector<ObjectHolder>& stack) : stack_(stack), base_(stack.size()) {}
+
+            ~StackGuard() {
+                this->stack_.resize(this->base_);
+            }
+        private:
+            std::vector<ObjectHolder>& stack_;
+            size_t base_;
+        };
+
+        ObjectHolder Pop(std::vector<ObjectHolder>& stack) {
+            ObjectHolder result = std::move(stack.back());
+            stack.pop_back();
+            return result;
+        }
+
+        ObjectHolder MakeConstant(const Constant& value) {
+            if (const auto* num = std::get_if<int>(&value)) {
+                return ObjectHolder::Own(runtime::Number(*num));
+            }
+            if (const auto* str = std::get_if<std::string>(&value)) {
+                return ObjectHolder::Own(runtime::String(*str));
+            }
+            return ObjectHolder::Own(runtime::Bool(std::get<bool>(value)));
+        }
+
+        ObjectHolder MakeInstance(const runtime::Class& cls, std::vector<ObjectHolder> args, Context& context) {
+            auto result = ObjectHolder::Own(runtime::ClassInstance(cls));
+            auto* instance = result.TryAs<runtime::ClassInstance>();
+            if (instance->HasMethod(INIT_METHOD, args.size())) {
+                instance->Call(INIT_METHOD, args, context);
+            }
+            return result;
+        }
+
+        std::vector<ObjectHolder> PopArgs(std::vector<ObjectHolder>& stack, size_t count) {
+            std::vector<ObjectHolder> args(std::make_move_iterator(stack.end() - count), std::make_move_iterator(stack.end()));
+            stack.resize(stack.size() - count);
+            return args;
+        }
+
+        runtime::ClassInstance& ExpectInstance(const ObjectHolder& object) {
+            auto* instance = object.TryAs<runtime::ClassInstance>();
+            if (instance == nullptr) {
+                throw std::runtime_error("Object is not a class instance");
+            }
+            return *instance;
+        }
+    }  // namespace
+
+    VirtualMachine::VirtualMachine(const Program& program) : program_(program) {
+        for (const auto& constant : program.constants) {
+            this->constants_.push_back(MakeConstant(constant));
+        }
+        for (const auto& name : program.names) {
+            this->field_caches_.emplace_back(name);
+            this->call_caches_.emplace_back(name);
+        }
+        for (const auto& info : program.classes) {
+            std::vector<runtime::Method> methods;
+            for (const auto& method : info.methods) {
+                methods.push_back({ method.name, method.formal_params, std::make_unique<CompiledMethod>(*this, method.chunk), method.frame_size });
+            }
+            const runtime::Class* parent = info.parent ? &this->GetClass(*info.parent) : nullptr;
+            this->classes_.push_back(ObjectHolder::Own(runtime::Class(info.name, std::move(methods), parent)));
+        }
+    }
+
+    ObjectHolder VirtualMachine::Run(Closure& closure, Context& context) {
+        return this->Run(0, closure, context);
+    }
+
+    ObjectHolder VirtualMachine::Run(uint32_t chunk, Closure& closure, Context& context) {
+        const auto& code = this->program_.chunks[chunk].code;
+        auto& stack = this->stack_;
+        StackGuard guard(stack);
+
+        for (size_t pc = 0;;) {
+            const Instruction& ins = code[pc++];
+            switch (ins.op) {
+            case OpCode::LoadConst:
+                stack.push_back(this->constants_[ins.arg]);
+                break;
+            case OpCode::LoadNone:
+                stack.push_back(ObjectHolder::None());
+                break;
+            case OpCode::LoadVar: {
+                auto it = closure.find(this->program_.names[ins.arg]);
+                if (it == closure.end()) {
+                    throw std::runtime_error("Not in list");
+                }
+                stack.push_back(it->second);
+                break;
+            }
+            case OpCode::LoadLocal: {
+                const auto& local = context.GetLocal(ins.arg);
+                if (!local) {
+                    throw std::runtime_error("Not in list");
+                }
+                stack.push_back(*local);
+                break;
+            }
+            case OpCode::LoadField: {
+                auto object = Pop(stack);
+                const auto* field = this->field_caches_[ins.arg].Find(ExpectInstance(object));
+                if (field == nullptr) {
+                    throw std::runtime_error("Not in list");
+                }
+                stack.push_back(*field);
+                break;
+            }
+            case OpCode::StoreVar:
+                closure[this->program_.names[ins.arg]] = stack.back();
+                break;
+            case OpCode::StoreLocal:
+                context.GetLocal(ins.arg) = stack.back();
+                break;
+            case OpCode::StoreField: {
+                auto value = Pop(stack);
+                auto object = Pop(stack);
+                this->field_caches_[ins.arg].Assign(ExpectInstance(object), value);
+                stack.push_back(std::move(value));
+                break;
+            }
+            case OpCode::Pop:
+                stack.pop_back();
+                break;
+            case OpCode::Print: {
+                auto args = PopArgs(stack, ins.count);
+                auto& os = context.GetOutputStream();
+                for (size_t ptr = 0; ptr < args.size(); ptr++) {
+                    if (args[ptr]) {
+                        args[ptr]->Print(os, context);
+                    } else {
+                        os << "None";
+                    }
+                    if (ptr < args.size() - 1) {
+                        os << " ";
+                    }
+                }
+                os << "\n";
+                stack.push_back(ObjectHolder::None());
+                break;
+            }
+            case OpCode::Stringify: {
+                auto arg = Pop(stack);
+                stringstream tmp_str;
+                if (arg) {
+                    arg->Print(tmp_str, context);
+                } else {
+                    tmp_str << "None";
+                }
+                stack.push_back(ObjectHolder::Own(runtime::String(tmp_str.str())));
+                break;
+            }
+            case OpCode::Add:
+            case OpCode::Sub:
+            case OpCode::Mult:
+            case OpCode::Div: {
+                auto rhs = Pop(stack);
+                auto lhs = Pop(stack);
+                switch (ins.op) {
+                case OpCode::Add:
+                    stack.push_back(runtime::Add(lhs, rhs, context));
+                    break;
+                case OpCode::Sub:
+                    stack.push_back(runtime::Sub(lhs, rhs, context));
+                    break;
+                case OpCode::Mult:
+                    stack.push_back(runtime::Mult(lhs, rhs, context));
+                    break;
+                default:
+                    stack.push_back(runtime::Div(lhs, rhs, context));
+                    break;
+                }
+                break;
+            }
+            case OpCode::And: {
+                auto rhs = Pop(stack);
+                auto lhs = Pop(stack);
+                stack.push_back(ObjectHolder::Own(runtime::Bool(runtime::IsTrue(lhs) && runtime::IsTrue(rhs))));
+                break;
+            }
+            case OpCode::Or: {
+                auto rhs = Pop(stack);
+                auto lhs = Pop(stack);
+                stack.push_back(ObjectHolder::Own(runtime::Bool(runtime::IsTrue(lhs) || runtime::IsTrue(rhs))));
+                break;
+            }
+            case OpCode::Not:
+                stack.back() = ObjectHolder::Own(runtime::Bool(!runtime::IsTrue(stack.back())));
+                break;
+            case OpCode::Equal:
+            case OpCode::NotEqual:
+            case OpCode::Less:
+            case OpCode::Greater:
+            case OpCode::LessOrEqual:
+            case OpCode::GreaterOrEqual: {
+                auto rhs = Pop(stack);
+                auto lhs = Pop(stack);
+                bool result = false;
+                switch (ins.op) {
+                case OpCode::Equal:
+                    result = runtime::Equal(lhs, rhs, context);
+                    break;
+                case OpCode::NotEqual:
+                    result = runtime::NotEqual(lhs, rhs, context);
+                    break;
+                case OpCode::Less:
+                    result = runtime::Less(lhs, rhs, context);
+                    break;
+                case OpCode::Greater:
+                    result = runtime::Greater(lhs, rhs, context);
+                    break;
+                case OpCode::LessOrEqual:
+                    result = runtime::LessOrEqual(lhs, rhs, context);
+                    break;
+                default:
+                    result = runtime::GreaterOrEqual(lhs, rhs, context);
+                    break;
+                }
+                stack.push_back(ObjectHolder::Own(runtime::Bool(result)));
+                break;
+            }
+            case OpCode::Jump:
+                pc = ins.arg;
+                break;
+            case OpCode::JumpIfFalse:
+                if (!runtime::IsTrue(Pop(stack))) {
+                    pc = ins.arg;
+                }
+                break;
+            case OpCode::CallMethod: {
+                auto& cache = this->call_caches_[ins.arg];
+                auto args = PopArgs(stack, ins.count);
+                auto object = Pop(stack);
+                auto* instance = object.TryAs<runtime::ClassInstance>();
+                const auto* method = instance != nullptr ? cache.Lookup(instance->GetClass(), args.size()) : nullptr;
+                if (method == nullptr) {
+                    throw std::runtime_error("Can not call method " + cache.GetName());
+                }
+                stack.push_back(instance->Call(*method, args, context));
+                break;
+            }
+            case OpCode::NewInstance: {
+                auto args = PopArgs(stack, ins.count);
+                stack.push_back(MakeInstance(this->GetClass(ins.arg), std::move(args), context));
+                break;
+            }
+            case OpCode::DefineClass: {
+                const auto& cls = this->GetClass(ins.arg);
+                auto instance = MakeInstance(cls, {}, context);
+                closure[cls.GetName()] = instance;
+                stack.push_back(std::move(instance));
+                break;
+            }
+            case OpCode::Return:
+                return Pop(stack);
+            case OpCode::Exec:
+                stack.push_back(this->program_.fallbacks[ins.arg]->Execute(closure, context));
+                break;
+            }
+        }
+    }
+
+    const runtime::Class& VirtualMachine::GetClass(uint32_t id) const {
+        return static_cast<const runtime::Class&>(*this->classes_[id]);
+    }
+
+    CompiledMethod::CompiledMethod(VirtualMachine& vm, uint32_t chunk) : vm_(vm), chunk_(chunk) {}
+
+    ObjectHolder CompiledMethod::Execute(Closure& closure, Context& context) {
+        return this->vm_.Run(this->chunk_, closure, context);
+    }
+
+}  // namespace bytecode
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "bytecode.h"
+#include "runtime.h"
+
+#include <deque>
+#include <vector>
+
+namespace bytecode {
+
+    // Runs a compiled program. Classes of the program are recreated on load with compiled method
+    // bodies, so dunder calls made by the runtime (__str__, __eq__, __init__) stay in bytecode too
+    class VirtualMachine {
+    public:
+        explicit VirtualMachine(const Program& program);
+
+        VirtualMachine(const VirtualMachine&) = delete;
+        VirtualMachine& operator=(const VirtualMachine&) = delete;
+
+        runtime::ObjectHolder Run(runtime::Closure& closure, runtime::Context& context);
+
+        runtime::ObjectHolder Run(uint32_t chunk, runtime::Closure& closure, runtime::Context& context);
+    private:
+        const runtime::Class& GetClass(uint32_t id) const;
+
+        const Program& program_;
+        std::vector<runtime::ObjectHolder> constants_;
+        std::vector<runtime::ObjectHolder> classes_;
+        // One field and one call site cache per name of the program
+        std::vector<runtime::FieldCache> field_caches_;
+        std::deque<runtime::CallSiteCache> call_caches_;
+        std::vector<runtime::ObjectHolder> stack_;
+    };
+
+    class CompiledMethod : public runtime::Executable {
+    public:
+        CompiledMethod(VirtualMachine& vm, uint32_t chunk);
+
+        runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    private:
+        VirtualMachine& vm_;
+        uint32_t chunk_;
+    };
+
+}  // namespace bytecode
@@ -0,0 +1,380 @@
+#include "cache.h"
+#include "lexer.h"
+#include "parse.h"
+#include "statement.h"
+#include "test_runner_p.h"
+#include "vm.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+namespace bytecode {
+
+    namespace {
+
+        string RunTreeWalker(const string& program) {
+            istringstream is(program);
+            parse::Lexer lexer(is);
+            auto tree = ParseProgram(lexer);
+
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            tree->Execute(closure, context);
+            return context.output.str();
+        }
+
+        string RunBytecode(const string& program) {
+            istringstream is(program);
+            parse::Lexer lexer(is);
+            auto tree = ParseProgram(lexer);
+            auto compiled = Compile(*tree);
+            VirtualMachine vm(*compiled);
+
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            vm.Run(closure, context);
+            return context.output.str();
+        }
+
+        void AssertSameOutput(const string& program, const string& expected) {
+            ASSERT_EQUAL(RunTreeWalker(program), expected);
+            ASSERT_EQUAL(RunBytecode(program), expected);
+        }
+
+        void TestArithmeticsAndPrint() {
+            AssertSameOutput(R"(
+x = 4
+y = -x * 2 + 10 / 3
+z = 'a' + "b"
+print x, y, z, None, True, False
+print
+print str(x) + str(None)
+)"s, "4 -5 ab None True False\n\n4None\n"s);
+        }
+
+        void TestConditionsAndLogic() {
+            AssertSameOutput(R"(
+a = 1
+b = 2
+if a < b and not a == b:
+  print 'lt'
+else:
+  print 'ge'
+if a >= b or a != a:
+  print 'no'
+print a <= b, a > b, 'abc' < 'abd'
+)"s, "lt\nTrue False True\n"s);
+        }
+
+        void TestClassesAndInheritance() {
+            AssertSameOutput(R"(
+class Shape:
+  def __str__():
+    return "Shape"
+
+  def area():
+    return 0
+
+class Rect(Shape):
+  def __init__(w, h):
+    self.w = w
+    self.h = h
+
+  def area():
+    return self.w * self.h
+
+  def __eq__(other):
+    return self.area() == other.area()
+
+  def __lt__(other):
+    return self.area() < other.area()
+
+  def __add__(other):
+    return self.area() + other.area()
+
+r = Rect(2, 3)
+s = Rect(3, 2)
+t = Rect(5, 5)
+print Shape(), r.area(), t.area(), r == s, r < t, r + s
+t.w = 10
+print t.w, t.area()
+)"s, "Shape 6 25 True True 12\n10 50\n"s);
+        }
+
+        void TestRecursionAndEarlyReturn() {
+            AssertSameOutput(R"(
+class GCD:
+  def __init__():
+    self.call_count = 0
+
+  def calc(a, b):
+    self.call_count = self.call_count + 1
+    if a < b:
+      return self.calc(b, a)
+    if b == 0:
+      return a
+    return self.calc(a - b, b)
+
+  def nothing():
+    x = 1
+
+x = GCD()
+print x.calc(510510, 18629977)
+print x.calc(22, 17)
+print x.call_count, x.nothing()
+)"s, "17\n1\n115 None\n"s);
+        }
+
+        void TestMethodLocals() {
+            AssertSameOutput(R"(
+class Acc:
+  def __init__(start):
+    self.value = start
+
+  def sum(n, n):
+    total = self.value
+    i = 0
+    if n > 0:
+      total = total + self.sum(n - 1, n - 1) + n
+    self = 'shadowed'
+    return total
+
+  def swap(a, b):
+    t = a
+    a = b
+    b = t
+    return str(a) + str(b)
+
+x = 5
+a = Acc(1)
+print a.sum(3, 3), a.swap(1, 2), x
+)"s, "10 21 5\n"s);
+
+            const string unbound = R"(
+class Broken:
+  def read():
+    return y
+
+y = 1
+b = Broken()
+print b.read()
+)"s;
+            ASSERT_THROWS(RunTreeWalker(unbound), std::runtime_error);
+            ASSERT_THROWS(RunBytecode(unbound), std::runtime_error);
+        }
+
+        void TestOperandsAcrossMethodCalls() {
+            // The calls in the operands add fields and push frames while the other operand is held
+            AssertSameOutput(R"(
+class Box:
+  def __init__(v):
+    self.v = v
+
+  def bump(v):
+    self.v = v
+    self.a1 = 1
+    self.a2 = 2
+    self.a3 = 3
+    return v - 5
+
+  def __lt__(other):
+    self.b1 = 1
+    self.b2 = 2
+    self.b3 = 3
+    return self.v < other.v
+
+  def deep(n):
+    if n > 0:
+      return self.deep(n - 1)
+    return n
+
+  def check(x):
+    y = 'abc'
+    print x < self.deep(30) + 3, y == 'abc', self.v < self.bump(10), self.v
+
+b = Box(1)
+c = Box(2)
+b.check(1)
+print b < c, c.v + b.bump(3) > b.v, not b.v == c.v
+)"s, "True True True 10\nFalse False True\n"s);
+        }
+
+        void TestRuntimeErrorsMatch() {
+            const string program = R"(
+x = 1
+print x / 0
+)"s;
+            ASSERT_THROWS(RunTreeWalker(program), std::runtime_error);
+            ASSERT_THROWS(RunBytecode(program), std::runtime_error);
+        }
+
+        // Calls of one name share a cache, a hit must still check the number of arguments
+        void TestCallsWithOtherArity() {
+            const string program = R"(
+class A:
+  def f(x):
+    return x
+
+a = A()
+print a.f(1)
+print a.f(1, 2)
+)"s;
+            ASSERT_THROWS(RunTreeWalker(program), std::runtime_error);
+            ASSERT_THROWS(RunBytecode(program), std::runtime_error);
+            AssertSameOutput(R"(
+class A:
+  def f(x):
+    return x
+
+class B:
+  def f(x, y):
+    return x + y
+
+a = A()
+b = B()
+print a.f(1), b.f(1, 2), a.f(3)
+)"s, "1 3 3\n"s);
+        }
+
+        void TestCustomComparatorFallsBack() {
+            auto always = [](const runtime::ObjectHolder&, const runtime::ObjectHolder&, runtime::Context&) {
+                return true;
+            };
+            ast::Print print(make_unique<ast::Comparison>(always, make_unique<ast::NumericConst>(1),
+                make_unique<ast::NumericConst>(2)));
+
+            auto compiled = Compile(print);
+            ASSERT_EQUAL(compiled->fallbacks.size(), 1U);
+
+            VirtualMachine vm(*compiled);
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            vm.Run(closure, context);
+            ASSERT_EQUAL(context.output.str(), "True\n"s);
+        }
+
+        const string CACHED_PROGRAM = R"(
+class Counter:
+  def __init__(start):
+    self.value = start
+
+  def down(n):
+    if n > 0:
+      self.value = self.value + n
+      return self.down(n - 1)
+    return self.value
+
+class Named(Counter):
+  def __str__():
+    return 'counter ' + str(self.value)
+
+c = Named(1)
+print c.down(4), c, 'a' < 'b', None
+)"s;
+
+        const string CACHED_OUTPUT = "11 counter 11 True None\n"s;
+
+        string RunProgram(const Program& program) {
+            VirtualMachine vm(program);
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            vm.Run(closure, context);
+            return context.output.str();
+        }
+
+        string SaveToString(const string& text, uint64_t hash) {
+            istringstream is(text);
+            parse::Lexer lexer(is);
+            auto tree = ParseProgram(lexer);
+            auto compiled = Compile(*tree);
+            ostringstream os;
+            Save(*compiled, hash, os);
+            return os.str();
+        }
+
+        void TestCacheRoundTrip() {
+            const uint64_t hash = HashSource(CACHED_PROGRAM);
+            const string data = SaveToString(CACHED_PROGRAM, hash);
+
+            auto loaded = Load(data, hash);
+            ASSERT(loaded != nullptr);
+            ASSERT_EQUAL(RunProgram(*loaded), CACHED_OUTPUT);
+
+            ASSERT(Load(data, hash + 1) == nullptr);
+            ASSERT(Load(""sv, hash) == nullptr);
+            for (size_t size = 0; size < data.size(); size += 7) {
+                ASSERT(Load(string_view(data).substr(0, size), hash) == nullptr);
+            }
+            for (size_t ptr = 0; ptr < data.size(); ptr += 5) {
+                string corrupted = data;
+                corrupted[ptr] = static_cast<char>(corrupted[ptr] ^ 0x5A);
+                ASSERT(Load(corrupted, hash) == nullptr);
+            }
+        }
+
+        void TestFallbacksAreNotCached() {
+            auto always = [](const runtime::ObjectHolder&, const runtime::ObjectHolder&, runtime::Context&) {
+                return true;
+            };
+            ast::Print print(make_unique<ast::Comparison>(always, make_unique<ast::NumericConst>(1),
+                make_unique<ast::NumericConst>(2)));
+            auto compiled = Compile(print);
+
+            ASSERT(!CanSave(*compiled));
+            ostringstream os;
+            ASSERT_THROWS(Save(*compiled, 0, os), std::invalid_argument);
+        }
+
+        void TestCacheFile() {
+            const string path = "mython_cache_test.my"s;
+            const string cache_path = GetCachePath(path);
+            ASSERT_EQUAL(cache_path, "mython_cache_test.myc"s);
+            {
+                ofstream file(path);
+                file << CACHED_PROGRAM;
+            }
+            std::remove(cache_path.c_str());
+
+            auto compiled = LoadOrCompile(path);
+            ASSERT(!compiled.from_cache);
+            ASSERT_EQUAL(RunProgram(*compiled.program), CACHED_OUTPUT);
+
+            auto cached = LoadOrCompile(path);
+            ASSERT(cached.from_cache);
+            ASSERT(cached.tree == nullptr);
+            ASSERT_EQUAL(RunProgram(*cached.program), CACHED_OUTPUT);
+
+            {
+                ofstream file(path, ios::app);
+                file << "print 'edited'\n"s;
+            }
+            auto edited = LoadOrCompile(path, parse::LexerMode::Streaming);
+            ASSERT(!edited.from_cache);
+            ASSERT_EQUAL(RunProgram(*edited.program), CACHED_OUTPUT + "edited\n"s);
+            ASSERT(LoadOrCompile(path).from_cache);
+
+            std::remove(path.c_str());
+            std::remove(cache_path.c_str());
+        }
+
+    }  // namespace
+
+    void RunVmTests(TestRunner& tr) {
+        RUN_TEST(tr, bytecode::TestArithmeticsAndPrint);
+        RUN_TEST(tr, bytecode::TestConditionsAndLogic);
+        RUN_TEST(tr, bytecode::TestClassesAndInheritance);
+        RUN_TEST(tr, bytecode::TestRecursionAndEarlyReturn);
+        RUN_TEST(tr, bytecode::TestMethodLocals);
+        RUN_TEST(tr, bytecode::TestOperandsAcrossMethodCalls);
+        RUN_TEST(tr, bytecode::TestRuntimeErrorsMatch);
+        RUN_TEST(tr, bytecode::TestCallsWithOtherArity);
+        RUN_TEST(tr, bytecode::TestCustomComparatorFallsBack);
+        RUN_TEST(tr, bytecode::TestCacheRoundTrip);
+        RUN_TEST(tr, bytecode::TestFallbacksAreNotCached);
+        RUN_TEST(tr, bytecode::TestCacheFile);
+    }
+
+}  // namespace bytecode